@@ -0,0 +1,98 @@
+/*
+ * File      : arena.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+static size_t align_size(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static void push_block(buffer_arena *arena, size_t size)
+{
+    arena_block *block = malloc(sizeof (arena_block));
+
+    size = align_size(size);
+    if (block) {
+        block->data = aligned_alloc(ARENA_ALIGNMENT, size);
+    }
+    if (!block || !block->data) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+}
+
+static void free_blocks(buffer_arena *arena)
+{
+    while (arena->blocks) {
+        arena_block *next = arena->blocks->next;
+
+        free(arena->blocks->data);
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+}
+
+void arena_init(buffer_arena *arena, size_t size)
+{
+    arena->blocks = NULL;
+    arena->used = 0;
+    arena->high_water = 0;
+    push_block(arena, size > ARENA_MIN_BLOCK_SIZE ? size :
+                                                    ARENA_MIN_BLOCK_SIZE);
+}
+
+void *arena_alloc(buffer_arena *arena, size_t size)
+{
+    arena_block *block = arena->blocks;
+    void *ptr;
+
+    size = align_size(size ? size : 1);
+    if (block->size - block->used < size) {
+        /* Previous blocks stay valid until the next reset */
+        push_block(arena, size > 2 * block->size ? size : 2 * block->size);
+        block = arena->blocks;
+    }
+
+    ptr = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+
+    return ptr;
+}
+
+void arena_reset(buffer_arena *arena)
+{
+    if (arena->blocks->next) {
+        free_blocks(arena);
+        push_block(arena, arena->high_water);
+    }
+    arena->blocks->used = 0;
+    arena->used = 0;
+}
+
+void arena_destroy(buffer_arena *arena)
+{
+    free_blocks(arena);
+    arena->used = 0;
+    arena->high_water = 0;
+}
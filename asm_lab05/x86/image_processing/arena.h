@@ -0,0 +1,42 @@
+/*
+ * File      : arena.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Grow-only buffer arena : allocations are bumped from a block and all
+ * released at once. Once the arena has grown to the largest need, a
+ * batch of images is processed without calling the system allocator.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGNMENT 64 /* Cache line */
+#define ARENA_MIN_BLOCK_SIZE (1024 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    uint8_t *data;
+} arena_block;
+
+typedef struct {
+    arena_block *blocks;  /* The block in use is the first one */
+    size_t used;          /* Bytes given since the last reset */
+    size_t high_water;    /* Most bytes given between two resets */
+} buffer_arena;
+
+void arena_init(buffer_arena *arena, size_t size);
+/* Returns size bytes aligned on ARENA_ALIGNMENT, not zeroed.
+ * Exits when out of memory */
+void *arena_alloc(buffer_arena *arena, size_t size);
+/* Releases all the allocations, the blocks are merged into a single one
+ * big enough for the largest use so far */
+void arena_reset(buffer_arena *arena);
+void arena_destroy(buffer_arena *arena);
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,526 @@
+/*
+ * File      : bench.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _GNU_SOURCE /* clock_gettime() */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "bench.h"
+#include "chain.h"
+#include "convolution.h"
+#include "gradient.h"
+#include "histogram.h"
+#include "image_processing.h"
+#include "integral.h"
+#include "median.h"
+#include "morphology.h"
+#include "planar.h"
+#include "pyramid.h"
+#include "thread_pool.h"
+
+typedef struct {
+    const char *name;
+    bool color;         /* Takes the color image instead of the grayscale */
+    bool threaded;      /* Runs on the thread pool */
+    image_container *(*run)(image_container *img);
+    bool (*supported)(void);
+    double target;      /* Median cycles per pixel not to exceed, 0 : none */
+} bench_variant;
+
+static const char *const bench_files[] = {
+    IMAGE_FILE, "smaller_image.png", "mini_5x5.png"
+};
+
+static const int bench_sizes[][2] = {
+    { 64, 64 }, { 320, 240 }, { 1280, 720 }, { 1920, 1080 }
+};
+
+static image_container *run_asm_sse2(image_container *img)
+{
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+
+    asm_filter_image_sse2(img->data, dst->data, img->width, img->height,
+                          img->stride, dst->stride, kernel_to_use->coeffs);
+    return dst;
+}
+
+static image_container *run_asm_avx2(image_container *img)
+{
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+
+    asm_filter_image_avx2(img->data, dst->data, img->width, img->height,
+                          img->stride, dst->stride, kernel_to_use->coeffs);
+    return dst;
+}
+
+/* asm_filter() loads and stores a pixel with 4 bytes movl, the last one
+ * goes 3 bytes past the image */
+#define ASM_PIXEL_SLACK 3
+
+/* The first version, one call per pixel. asm_filter() only knows rows
+ * without padding, the image is packed around the calls */
+static image_container *run_asm_pixel(image_container *img)
+{
+    const size_t size = (size_t)img->width * img->height;
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+    uint8_t *src_packed = malloc(size + ASM_PIXEL_SLACK);
+    uint8_t *dst_packed = malloc(size + ASM_PIXEL_SLACK);
+    int32_t x, y;
+
+    if (!src_packed || !dst_packed) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    for (y = 0; y < img->height; ++y) {
+        memcpy(src_packed + (size_t)y * img->width, image_row(img, y),
+               img->width);
+    }
+    for (y = 0; y < img->height; ++y) {
+        for (x = 0; x < img->width; ++x) {
+            asm_filter(src_packed, dst_packed, img->width, img->height, x, y);
+        }
+    }
+    for (y = 0; y < img->height; ++y) {
+        memcpy(image_row(dst, y), dst_packed + (size_t)y * img->width,
+               img->width);
+    }
+    free(src_packed);
+    free(dst_packed);
+    return dst;
+}
+
+/* 5x5 Gaussian of sigma 1 as a float kernel, the outer product of the
+ * normalized 1D weights */
+static const conv_kernel *float_gaussian_5x5(void)
+{
+    static const float weights[KERNEL_SIZE_5] = {
+        0.054489f, 0.244201f, 0.402620f, 0.244201f, 0.054489f
+    };
+    static float coeffs[KERNEL_SIZE_5 * KERNEL_SIZE_5];
+    static conv_kernel kernel = { .size = KERNEL_SIZE_5, .factor = 1,
+                                  .fcoeffs = coeffs };
+    int i, j;
+
+    for (j = 0; j < KERNEL_SIZE_5; ++j) {
+        for (i = 0; i < KERNEL_SIZE_5; ++i) {
+            coeffs[j * KERNEL_SIZE_5 + i] = weights[j] * weights[i];
+        }
+    }
+    return &kernel;
+}
+
+/* Float kernel on one thread, asm_conv_row_float_fma() for each row */
+static image_container *run_float_5x5(image_container *img)
+{
+    const conv_border border = { BORDER_COPY, 0 };
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+
+    conv_rows(img, dst, float_gaussian_5x5(), &border, 0, img->height);
+    return dst;
+}
+
+/* Same into 16 bits pixels, the container has two bytes per pixel */
+static image_container *run_float_5x5_16(image_container *img)
+{
+    const conv_border border = { BORDER_COPY, 0 };
+    image_container *dst = allocate_container(2 * img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+
+    conv_rows16(img, (uint16_t *)dst->data, dst->stride / sizeof (uint16_t),
+                float_gaussian_5x5(), &border, 0, img->height);
+    return dst;
+}
+
+static image_container *run_median(image_container *img, int shape,
+                                   int32_t radius)
+{
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+
+    median_rows(img, dst, shape, radius, 0, img->height);
+    return dst;
+}
+
+static image_container *run_median_cross(image_container *img)
+{
+    return run_median(img, MEDIAN_CROSS, 1);
+}
+
+static image_container *run_median_3x3(image_container *img)
+{
+    return run_median(img, MEDIAN_SQUARE, 1);
+}
+
+static image_container *run_median_7x7(image_container *img)
+{
+    return run_median(img, MEDIAN_SQUARE, 3);
+}
+
+/* Box blur of the denoise windows, table included */
+static image_container *run_box_15(image_container *img)
+{
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+    integral_image integral;
+
+    integral_build(&integral, img, false);
+    integral_mean_rows(&integral, dst, 15, 0, img->height);
+    integral_free(&integral);
+    return dst;
+}
+
+/* Adaptive threshold of the same windows, with the table of the squares */
+static image_container *run_threshold_15(image_container *img)
+{
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+    integral_image integral;
+
+    integral_build(&integral, img, true);
+    integral_threshold_rows(&integral, img, dst, 15, 0, 0, img->height);
+    integral_free(&integral);
+    return dst;
+}
+
+/* Sharpen then edge detection of the color image, one stage per pass
+ * with the full intermediate images in memory */
+static image_container *run_sharpen_edge(image_container *img)
+{
+    static const char *const stages[] = { "gray", "sharpen", "edge" };
+    image_container *src = img, *dst;
+    filter_chain chain;
+    size_t s;
+
+    for (s = 0; s < sizeof (stages) / sizeof (*stages); ++s) {
+        chain_parse(stages[s], &chain);
+        /* The gray stage of a grayscale image is dropped by chain_run() */
+        dst = chain_run(&chain, src);
+        if (src != img) {
+            free_container(src);
+        }
+        src = dst;
+    }
+    return dst;
+}
+
+/* Same in one pass */
+static image_container *run_sharpen_edge_chain(image_container *img)
+{
+    filter_chain chain;
+
+    chain_parse("sharpen,edge", &chain);
+    return chain_run(&chain, img);
+}
+
+static image_container *run_erode_31(image_container *img)
+{
+    const morph_filter morph = { MORPH_ERODE, 31, 31 };
+
+    return morphology(img, &morph);
+}
+
+static image_container *run_close_9(image_container *img)
+{
+    const morph_filter morph = { MORPH_CLOSE, 9, 9 };
+
+    return morphology(img, &morph);
+}
+
+/* Histogram drawn as a row of 256 pixels, the largest count is white */
+static image_container *run_histogram(image_container *img)
+{
+    image_container *dst = allocate_container(HIST_BINS, 1,
+                                              COMPONENT_GRAYSCALE);
+    image_histogram hist;
+    uint64_t top = 1;
+    int v;
+
+    histogram_compute(img, &hist);
+    for (v = 0; v < HIST_BINS; ++v) {
+        if (hist.count[v] > top) {
+            top = hist.count[v];
+        }
+    }
+    for (v = 0; v < HIST_BINS; ++v) {
+        dst->data[v] = hist.count[v] * UINT8_MAX / top;
+    }
+    return dst;
+}
+
+/* Equalization of a copy, histogram included */
+static image_container *run_equalize(image_container *img)
+{
+    image_container *dst = allocate_container(img->width, img->height,
+                                              COMPONENT_GRAYSCALE);
+    image_histogram hist;
+    uint8_t lut[HIST_BINS];
+
+    copy_container_rows(dst, img);
+    histogram_compute(dst, &hist);
+    histogram_equalize_lut(&hist, lut);
+    histogram_apply_lut(dst, lut);
+    return dst;
+}
+
+/* Convolution of each color plane, split and merge included */
+static image_container *run_planar(image_container *img)
+{
+    const conv_border border = { BORDER_COPY, 0 };
+    planar_image planes, filtered;
+    image_container *dst;
+
+    planar_split(&planes, img);
+    planar_convolve(&planes, &filtered, kernel_to_use, &border);
+    dst = planar_merge(&filtered);
+    planar_free(&planes);
+    planar_free(&filtered);
+    return dst;
+}
+
+static image_container *run_downscale2(image_container *img)
+{
+    return downscale2(img);
+}
+
+/* Gaussian pyramid of 5 levels, the smallest one is kept */
+static image_container *run_pyramid(image_container *img)
+{
+    image_pyramid pyr;
+    image_container *last;
+
+    pyramid_gaussian(&pyr, img, 5);
+    last = pyr.level[--pyr.nb_levels];
+    pyramid_free(&pyr);
+    return last;
+}
+
+static image_container *run_sobel(image_container *img)
+{
+    const gradient_filter grad = { GRADIENT_SOBEL, false, false };
+
+    return gradient(img, &grad, NULL);
+}
+
+/* Scharr with the L2 magnitude and the orientation, the magnitude is kept */
+static image_container *run_scharr_dir(image_container *img)
+{
+    const gradient_filter grad = { GRADIENT_SCHARR, true, true };
+    image_container *dir, *mag = gradient(img, &grad, &dir);
+
+    free_container(dir);
+    return mag;
+}
+
+static bool avx2_supported(void)
+{
+    return student_filter_supported() && __builtin_cpu_supports("avx2");
+}
+
+static bool fma_supported(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+/* asm_filter() has the edge detection kernel built in */
+static bool asm_pixel_supported(void)
+{
+    return kernel_to_use->coeffs == edge_detection_3x3;
+}
+
+static const bench_variant bench_variants[] = {
+    { "grayscale",    true,  true,  grayscale_conversion,       NULL },
+    { "c",            false, true,  apply_filter_reference,     NULL },
+    { "asm",          false, true,  apply_filter_student,
+      student_filter_supported },
+    { "asm_sse2",     false, false, run_asm_sse2,
+      student_filter_supported },
+    { "asm_avx2",     false, false, run_asm_avx2,               avx2_supported },
+    { "asm_pixel",    false, false, run_asm_pixel,
+      asm_pixel_supported },
+    { "asm_fused",    true,  true,  apply_filter_student_fused,
+      student_filter_supported },
+    { "float_5x5",    false, false, run_float_5x5,              fma_supported,
+      BENCH_FLOAT_TARGET },
+    { "float_5x5_16", false, false, run_float_5x5_16,           fma_supported,
+      BENCH_FLOAT_TARGET },
+    { "median_cross", false, false, run_median_cross,           NULL },
+    { "median_3x3",   false, false, run_median_3x3,             NULL },
+    { "median_7x7",   false, false, run_median_7x7,             NULL },
+    { "box_31x31",    false, false, run_box_15,                 NULL },
+    { "threshold_31x31", false, false, run_threshold_15,        NULL },
+    { "erode_31x31",  false, true,  run_erode_31,               NULL },
+    { "close_9x9",    false, true,  run_close_9,                NULL },
+    { "histogram",    false, true,  run_histogram,              NULL },
+    { "equalize",     false, true,  run_equalize,               NULL },
+    { "downscale2",   false, true,  run_downscale2,             NULL },
+    { "pyramid_5",    false, true,  run_pyramid,                NULL },
+    { "sobel",        false, true,  run_sobel,                  NULL },
+    { "scharr_l2_dir", false, true, run_scharr_dir,             NULL },
+    { "planar",       true,  true,  run_planar,                 NULL },
+    { "sharpen_edge", true,  true,  run_sharpen_edge,           NULL },
+    { "sharpen_edge_chain", true, true, run_sharpen_edge_chain, NULL },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+
+    return (da > db) - (da < db);
+}
+
+/* Synthetic RGB image : gradients with some noise so that neither the
+ * filters nor the median see flat areas */
+static image_container *synthetic_image(int width, int height)
+{
+    image_container *img = allocate_container(width, height, COMPONENT_RGB);
+    uint32_t seed = 12345;
+    int32_t x, y;
+    uint8_t *p;
+
+    for (y = 0; y < height; ++y) {
+        p = image_row(img, y);
+        for (x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            *p++ = (x * 255 / width) ^ (seed >> 28);
+            *p++ = (y * 255 / height) ^ (seed >> 24 & 0xf);
+            *p++ = ((x + y) & 0xff) ^ (seed >> 20 & 0xf);
+        }
+    }
+    return img;
+}
+
+static void bench_variant_run(const char *name, const bench_variant *variant,
+                              image_container *img, int nb_threads)
+{
+    static double cycles[BENCH_MAX_RUNS], seconds[BENCH_MAX_RUNS];
+    const double pixels = (double)img->width * img->height;
+    double total = 0;
+    int runs = 0, p99;
+
+    /* Warm up the caches and the pool */
+    free_container(variant->run(img));
+
+    while (runs < BENCH_MIN_RUNS ||
+           (total < BENCH_MIN_TIME && runs < BENCH_MAX_RUNS)) {
+        double start = now();
+        uint64_t tsc = __rdtsc();
+        image_container *result = variant->run(img);
+
+        cycles[runs] = __rdtsc() - tsc;
+        seconds[runs] = now() - start;
+        total += seconds[runs];
+        runs++;
+        free_container(result);
+    }
+
+    qsort(cycles, runs, sizeof (double), compare_double);
+    qsort(seconds, runs, sizeof (double), compare_double);
+    p99 = (int)ceil(0.99 * runs) - 1;
+
+    printf("%s,%d,%d,%s,%d,%d,%.3f,%.3f,%.1f\n", name, img->width,
+           img->height, variant->name, variant->threaded ? nb_threads : 1,
+           runs, cycles[runs / 2] / pixels, cycles[p99] / pixels,
+           pixels * img->comp / seconds[runs / 2] / 1e6);
+    fflush(stdout);
+
+    if (variant->target && cycles[runs / 2] / pixels > variant->target) {
+        fprintf(stderr, "[%s] %s on %s : %.3f cycles per pixel, over the "
+                "target of %.1f\n", __func__, variant->name, name,
+                cycles[runs / 2] / pixels, variant->target);
+    }
+}
+
+static void bench_image(const char *name, image_container *img)
+{
+    const int nb_threads = thread_pool_size();
+    image_container *gray;
+    size_t v;
+
+    if (img->comp == COMPONENT_GRAYSCALE) {
+        gray = img;
+    } else if (img->comp == COMPONENT_RGB || img->comp == COMPONENT_RGBA) {
+        gray = grayscale_conversion(img);
+    } else {
+        fprintf(stderr, "[%s] %s skipped (%d components)\n", __func__, name,
+                img->comp);
+        return;
+    }
+
+    for (v = 0; v < sizeof (bench_variants) / sizeof (*bench_variants);
+         ++v) {
+        const bench_variant *variant = &bench_variants[v];
+
+        if (variant->supported && !variant->supported()) {
+            continue;
+        }
+        if (variant->color && img == gray) {
+            continue;
+        }
+        bench_variant_run(name, variant, variant->color ? img : gray,
+                          nb_threads);
+    }
+
+    if (gray != img) {
+        free_container(gray);
+    }
+}
+
+void bench_filters(void)
+{
+    char name[CMD_SIZE];
+    size_t i;
+
+    printf("image,width,height,variant,threads,runs,"
+           "cycles_per_pixel_median,cycles_per_pixel_p99,mb_per_s\n");
+
+    for (i = 0; i < sizeof (bench_files) / sizeof (*bench_files); ++i) {
+        image_container *img;
+
+        if (access(bench_files[i], R_OK)) {
+            fprintf(stderr, "[%s] %s not found, skipped\n", __func__,
+                    bench_files[i]);
+            continue;
+        }
+        img = load_image_rows(bench_files[i]);
+        bench_image(bench_files[i], img);
+        free_container(img);
+    }
+
+    for (i = 0; i < sizeof (bench_sizes) / sizeof (*bench_sizes); ++i) {
+        image_container *img = synthetic_image(bench_sizes[i][0],
+                                               bench_sizes[i][1]);
+
+        snprintf(name, CMD_SIZE, "synthetic_%dx%d", bench_sizes[i][0],
+                 bench_sizes[i][1]);
+        bench_image(name, img);
+        free_container(img);
+    }
+}
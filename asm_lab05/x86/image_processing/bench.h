@@ -0,0 +1,31 @@
+/*
+ * File      : bench.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Timing of the filter stages alone, without the PNG files and the
+ * external programs, to compare the implementations of a filter.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/* Each variant runs at least BENCH_MIN_RUNS times and until it has run
+ * BENCH_MIN_TIME seconds, at most BENCH_MAX_RUNS times */
+#define BENCH_MIN_RUNS 11
+#define BENCH_MAX_RUNS 1000
+#define BENCH_MIN_TIME 0.25
+
+/* Median TSC cycles per pixel of the 5x5 float convolutions (AVX2 and
+ * FMA, one thread), a slower run is reported on stderr. The C loops of
+ * the float kernels are far above it */
+#define BENCH_FLOAT_TARGET 8.0
+
+/* Runs every filter variant on the bundled images and on synthetic ones
+ * of several sizes. Prints one CSV line per image and variant : median
+ * and 99th percentile of the TSC cycles per pixel, and the input bytes
+ * processed per second (MB/s) from the median time.
+ * The threaded stages run on the pool started by the caller */
+void bench_filters(void);
+
+#endif /* __BENCH_H__ */
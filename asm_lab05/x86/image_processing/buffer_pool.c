@@ -0,0 +1,104 @@
+/*
+ * File      : buffer_pool.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "buffer_pool.h"
+
+/* Free buffers are linked through their first bytes */
+typedef struct pool_node {
+    struct pool_node *next;
+} pool_node;
+
+static struct {
+    pthread_mutex_t lock;
+    pool_node *free_lists[POOL_NB_CLASSES];
+    size_t cached_size;        /* Bytes on the free lists */
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Class of a buffer of size bytes and the size of the class. Classes
+ * past POOL_NB_CLASSES are not kept */
+static int pool_class(size_t size, size_t *class_size)
+{
+    size_t base = POOL_MIN_CLASS_SIZE, step, steps;
+    int index = 0;
+
+    if (size <= base) {
+        *class_size = base;
+        return 0;
+    }
+
+    /* Octave of the size : base < size <= 2 * base */
+    while (size > 2 * base) {
+        base *= 2;
+        index += POOL_CLASSES_PER_OCTAVE;
+    }
+    step = base / POOL_CLASSES_PER_OCTAVE;
+    steps = (size - base + step - 1) / step;
+    *class_size = base + steps * step;
+    return index + steps;
+}
+
+void *buffer_pool_alloc(size_t size)
+{
+    size_t class_size;
+    const int c = pool_class(size, &class_size);
+    void *ptr = NULL;
+
+    if (c < POOL_NB_CLASSES) {
+        pthread_mutex_lock(&pool.lock);
+        if (pool.free_lists[c]) {
+            ptr = pool.free_lists[c];
+            pool.free_lists[c] = pool.free_lists[c]->next;
+            pool.cached_size -= class_size;
+        }
+        pthread_mutex_unlock(&pool.lock);
+        if (ptr) {
+            return ptr;
+        }
+    }
+
+    /* The class sizes are multiples of the alignment */
+    ptr = aligned_alloc(POOL_ALIGNMENT, class_size);
+    if (!ptr) {
+        fprintf(stderr, "[%s] allocation error (%zu bytes)\n", __func__,
+                class_size);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+void buffer_pool_free(void *ptr, size_t size)
+{
+    size_t class_size;
+    const int c = pool_class(size, &class_size);
+    pool_node *node = ptr;
+
+    if (!ptr) {
+        return;
+    }
+    if (c < POOL_NB_CLASSES) {
+        pthread_mutex_lock(&pool.lock);
+        if (pool.cached_size + class_size <= POOL_MAX_CACHED_SIZE) {
+            node->next = pool.free_lists[c];
+            pool.free_lists[c] = node;
+            pool.cached_size += class_size;
+            node = NULL;
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    free(node);
+}
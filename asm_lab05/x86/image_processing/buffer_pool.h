@@ -0,0 +1,35 @@
+/*
+ * File      : buffer_pool.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Size-class pool of the image buffers. A released buffer goes on the
+ * free list of its class and is given again by the next allocation of
+ * that class, without the system allocator and without being zeroed, so
+ * the stages of a pipeline recycle the buffers of the previous ones.
+ * Thread safe.
+ */
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_ALIGNMENT 64 /* Cache line */
+#define POOL_MIN_CLASS_SIZE 4096
+/* Classes between two powers of two, a buffer is at most 25 % larger
+ * than asked */
+#define POOL_CLASSES_PER_OCTAVE 4
+#define POOL_NB_CLASSES 128
+/* Most bytes kept on the free lists, the other buffers are freed */
+#define POOL_MAX_CACHED_SIZE ((size_t)256 * 1024 * 1024)
+
+/* Returns size bytes aligned on POOL_ALIGNMENT, not zeroed.
+ * Exits when out of memory */
+void *buffer_pool_alloc(size_t size);
+
+/* Gives back a buffer of buffer_pool_alloc(), size as it was asked */
+void buffer_pool_free(void *ptr, size_t size);
+
+#endif /* __BUFFER_POOL_H__ */
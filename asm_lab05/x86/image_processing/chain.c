@@ -0,0 +1,265 @@
+/*
+ * File      : chain.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _DEFAULT_SOURCE /* strdup() and strtok_r() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain.h"
+#include "convolution.h"
+#include "median.h"
+#include "thread_pool.h"
+
+/* A band is at least this many times the rows computed twice for the
+ * stages above and below it */
+#define CHAIN_MIN_BAND_HALOS 4
+
+typedef struct {
+    const filter_chain *chain;
+    const image_container *src;
+    image_container *dst;
+} chain_args;
+
+/* State of one band : every stage but the last one writes its rows in a
+ * ring just large enough for the rows read by the next stage */
+typedef struct {
+    const chain_args *args;
+    uint8_t *ring[CHAIN_MAX_STAGES];
+    int32_t ring_rows[CHAIN_MAX_STAGES];
+    int32_t next_row[CHAIN_MAX_STAGES]; /* Next row computed by a stage */
+} chain_band;
+
+bool chain_parse(const char *spec, filter_chain *chain)
+{
+    char *copy, *token, *save, *value, *end;
+    chain_stage *stage;
+    long number;
+    bool valid = true;
+
+    chain->nb_stages = 1;
+    chain->stages[0] = (chain_stage) { .op = CHAIN_GRAYSCALE };
+
+    copy = strdup(spec);
+    if (!copy) {
+        fprintf(stderr, "[%s] strdup failed\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    for (token = strtok_r(copy, ",", &save); token && valid;
+         token = strtok_r(NULL, ",", &save)) {
+        value = strchr(token, ':');
+        if (value) {
+            *value++ = '\0';
+        }
+
+        /* Given or not, the conversion is the first stage */
+        if (!strcmp(token, "gray") && !value) {
+            valid = chain->nb_stages == 1;
+            continue;
+        }
+        if (chain->nb_stages == CHAIN_MAX_STAGES) {
+            valid = false;
+            break;
+        }
+        stage = &chain->stages[chain->nb_stages++];
+        memset(stage, 0, sizeof (*stage));
+
+        if (!strcmp(token, "median")) {
+            stage->op = CHAIN_MEDIAN;
+            stage->shape = value ? MEDIAN_SQUARE : MEDIAN_CROSS;
+            stage->radius = 1;
+            if (value) {
+                number = strtol(value, &end, 10);
+                valid = *value && !*end && number >= 1 &&
+                        number <= MEDIAN_MAX_RADIUS;
+                stage->radius = number;
+            }
+        } else if (!strcmp(token, "threshold") && value) {
+            stage->op = CHAIN_THRESHOLD;
+            number = strtol(value, &end, 10);
+            valid = *value && !*end && number >= 0 && number <= UINT8_MAX;
+            stage->threshold = number;
+        } else if (!value) {
+            stage->op = CHAIN_CONVOLUTION;
+            stage->kernel = strcmp(token, "kernel") ? kernel_find(token) :
+                                                      kernel_to_use;
+            valid = stage->kernel != NULL;
+            if (valid) {
+                stage->radius = stage->kernel->size / 2;
+            }
+        } else {
+            valid = false;
+        }
+    }
+
+    free(copy);
+    return valid;
+}
+
+/* Row y of the input of the stage k, the source image for the first one */
+static const uint8_t *stage_input(const chain_band *band, int k, int32_t y)
+{
+    const image_container *src = band->args->src;
+
+    if (k == 0) {
+        return image_row(src, y);
+    }
+    return band->ring[k - 1] +
+           (size_t)(y % band->ring_rows[k - 1]) * src->width;
+}
+
+/* Row y of the output of the stage k, the result image for the last one */
+static uint8_t *stage_output(const chain_band *band, int k, int32_t y)
+{
+    const chain_args *args = band->args;
+
+    if (k == args->chain->nb_stages - 1) {
+        return image_row(args->dst, y);
+    }
+    return band->ring[k] + (size_t)(y % band->ring_rows[k]) * args->dst->width;
+}
+
+/* Computes the rows of the stage k up to y_last. The rows of the previous
+ * stage are computed first, as they are needed. The rows closer than the
+ * stage radius to the top and bottom are copied as by conv_rows() and
+ * median_rows() */
+static void chain_advance(chain_band *band, int k, int32_t y_last)
+{
+    const chain_stage *stage = &band->args->chain->stages[k];
+    const int32_t width = band->args->dst->width;
+    const int32_t height = band->args->dst->height;
+    const int32_t radius = stage->radius;
+    const uint8_t *rows[2 * MEDIAN_MAX_RADIUS + 1];
+    int32_t y, j, x;
+    uint8_t *out;
+
+    while (band->next_row[k] <= y_last) {
+        y = band->next_row[k]++;
+
+        if (k > 0) {
+            chain_advance(band, k - 1,
+                          y + radius < height ? y + radius : height - 1);
+        }
+        out = stage_output(band, k, y);
+
+        if (y < radius || y >= height - radius) {
+            memcpy(out, stage_input(band, k, y), width);
+            continue;
+        }
+        for (j = 0; j < 2 * radius + 1; ++j) {
+            rows[j] = stage_input(band, k, y - radius + j);
+        }
+
+        switch (stage->op) {
+        case CHAIN_GRAYSCALE:
+            grayscale_row(rows[0], out, width, band->args->src->comp);
+            break;
+        case CHAIN_CONVOLUTION:
+            conv_row(rows, out, width, stage->kernel);
+            break;
+        case CHAIN_MEDIAN:
+            median_row(rows, out, width, stage->shape, radius);
+            break;
+        case CHAIN_THRESHOLD:
+            for (x = 0; x < width; ++x) {
+                out[x] = rows[0][x] > stage->threshold ? UINT8_MAX : 0;
+            }
+            break;
+        }
+    }
+}
+
+/* Runs all the stages on the rows [y_start, y_end[. Each stage starts
+ * early enough for the rows read by the stages after it */
+static void chain_band_rows(void *arg, int32_t y_start, int32_t y_end)
+{
+    const chain_args *args = arg;
+    const filter_chain *chain = args->chain;
+    const int last = chain->nb_stages - 1;
+    chain_band band = { .args = args };
+    size_t ring_size = 0;
+    int32_t halo = 0;
+    uint8_t *rings;
+    int k;
+
+    for (k = last; k >= 0; --k) {
+        band.next_row[k] = y_start - halo > 0 ? y_start - halo : 0;
+        halo += chain->stages[k].radius;
+        if (k < last) {
+            band.ring_rows[k] = 2 * chain->stages[k + 1].radius + 1;
+            ring_size += (size_t)band.ring_rows[k] * args->dst->width;
+        }
+    }
+
+    rings = malloc(ring_size ? ring_size : 1);
+    if (!rings) {
+        fprintf(stderr, "[%s] malloc failed\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0, ring_size = 0; k < last; ++k) {
+        band.ring[k] = rings + ring_size;
+        ring_size += (size_t)band.ring_rows[k] * args->dst->width;
+    }
+
+    chain_advance(&band, last, y_end - 1);
+
+    free(rings);
+}
+
+image_container *chain_run(const filter_chain *chain,
+                           const image_container *img)
+{
+    filter_chain run = *chain;
+    chain_args args = { .chain = &run, .src = img };
+    image_container *result;
+    int32_t halo = 0, band_rows;
+    int k;
+
+    /* The conversion has nothing to do on a grayscale image */
+    if (run.nb_stages && run.stages[0].op == CHAIN_GRAYSCALE &&
+        img->comp == COMPONENT_GRAYSCALE) {
+        memmove(run.stages, run.stages + 1,
+                --run.nb_stages * sizeof (chain_stage));
+    }
+    if (img->comp != COMPONENT_GRAYSCALE &&
+        (!run.nb_stages || run.stages[0].op != CHAIN_GRAYSCALE)) {
+        fprintf(stderr, "[%s] the chain must start with the grayscale "
+                "conversion of a color image\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    result = allocate_container(img->width, img->height, COMPONENT_GRAYSCALE);
+    if (!run.nb_stages) {
+        copy_container_rows(result, img);
+        return result;
+    }
+    args.dst = result;
+
+    for (k = 0; k < run.nb_stages; ++k) {
+        halo += run.stages[k].radius;
+    }
+
+    /* The source and result rows of a band stay in the cache, the rows
+     * of the rings are few. Larger bands when the halo is large so the
+     * rows computed twice stay a small part of the work */
+    band_rows = thread_pool_band_rows((size_t)img->width * (img->comp + 1),
+                                      halo);
+    if (band_rows < CHAIN_MIN_BAND_HALOS * halo) {
+        band_rows = CHAIN_MIN_BAND_HALOS * halo;
+    }
+    thread_pool_run(chain_band_rows, &args, img->height, band_rows);
+
+    return result;
+}
@@ -0,0 +1,54 @@
+/*
+ * File      : chain.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Chains of filters run in one pass. Each band of rows goes through all
+ * the stages while it is in the cache, the intermediate images are only
+ * kept as a few rows per stage instead of full frames.
+ */
+
+#ifndef __CHAIN_H__
+#define __CHAIN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+#include "kernels.h"
+
+#define CHAIN_MAX_STAGES 16
+
+/* Stage operations */
+#define CHAIN_GRAYSCALE   0 /* RGB(A) to grayscale, first stage only */
+#define CHAIN_CONVOLUTION 1 /* Convolution with the copy border */
+#define CHAIN_MEDIAN      2 /* See median.h */
+#define CHAIN_THRESHOLD   3 /* 255 above the threshold, 0 otherwise */
+
+typedef struct {
+    int op;
+    const conv_kernel *kernel; /* CHAIN_CONVOLUTION */
+    int shape;                 /* CHAIN_MEDIAN */
+    int32_t radius;            /* Rows needed above and below a row */
+    uint8_t threshold;         /* CHAIN_THRESHOLD */
+} chain_stage;
+
+typedef struct {
+    int nb_stages;
+    chain_stage stages[CHAIN_MAX_STAGES];
+} filter_chain;
+
+/* Reads a chain given as comma separated stages, in order :
+ * a kernel name of kernel_find(), kernel (kernel_to_use), median (cross),
+ * median:radius (square) and threshold:value. The chain always starts
+ * with the grayscale conversion, gray may be given as first stage.
+ * Returns false when a stage is unknown or the chain too long */
+bool chain_parse(const char *spec, filter_chain *chain);
+
+/* Runs the chain on img by bands of rows, on the thread pool.
+ * The grayscale conversion is skipped on a grayscale image.
+ * Same result as the stages applied one after the other on full images */
+image_container *chain_run(const filter_chain *chain,
+                           const image_container *img);
+
+#endif /* __CHAIN_H__ */
@@ -0,0 +1,823 @@
+/*
+ * File      : convolution.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "convolution.h"
+
+static const char *const border_names[] = {
+    [BORDER_COPY]     = "copy",
+    [BORDER_CLAMP]    = "clamp",
+    [BORDER_MIRROR]   = "mirror",
+    [BORDER_WRAP]     = "wrap",
+    [BORDER_CONSTANT] = "constant",
+};
+
+bool conv_border_parse(const char *arg, conv_border *border)
+{
+    const size_t constant_len = strlen(border_names[BORDER_CONSTANT]);
+    int mode;
+
+    for (mode = BORDER_COPY; mode < BORDER_CONSTANT; ++mode) {
+        if (!strcmp(arg, border_names[mode])) {
+            border->mode = mode;
+            border->value = 0;
+            return true;
+        }
+    }
+
+    if (strncmp(arg, border_names[BORDER_CONSTANT], constant_len)) {
+        return false;
+    }
+    border->mode = BORDER_CONSTANT;
+    border->value = 0;
+    if (arg[constant_len] == ':') {
+        char *end;
+        long value = strtol(arg + constant_len + 1, &end, 0);
+
+        if (*end || end == arg + constant_len + 1 ||
+            value < 0 || value > UCHAR_MAX) {
+            return false;
+        }
+        border->value = value;
+    } else if (arg[constant_len]) {
+        return false;
+    }
+    return true;
+}
+
+static int32_t gcd(int32_t a, int32_t b)
+{
+    a = abs(a);
+    b = abs(b);
+    while (b) {
+        int32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+bool kernel_separate(conv_kernel *kernel)
+{
+    const int32_t n = kernel->size;
+    int32_t i, j, pivot_row = -1, pivot_col = -1, divisor = 0;
+
+    if (kernel->fcoeffs) {
+        return false;
+    }
+    if (kernel->separable) {
+        return true;
+    }
+    if (n > MAX_KERNEL_SIZE) {
+        return false;
+    }
+
+    /* The first non zero row gives the row vector, reduced by the gcd of
+     * its coefficients. Every other row must then be an integer multiple
+     * of it : the multiples form the column vector */
+    for (j = 0; j < n && pivot_row < 0; ++j) {
+        for (i = 0; i < n; ++i) {
+            if (kernel->coeffs[j * n + i]) {
+                pivot_row = j;
+                pivot_col = i;
+                break;
+            }
+        }
+    }
+    if (pivot_row < 0) {
+        memset(kernel->row, 0, sizeof (kernel->row));
+        memset(kernel->col, 0, sizeof (kernel->col));
+        kernel->separable = true;
+        return true;
+    }
+
+    for (i = 0; i < n; ++i) {
+        divisor = gcd(divisor, kernel->coeffs[pivot_row * n + i]);
+    }
+    if (kernel->coeffs[pivot_row * n + pivot_col] < 0) {
+        divisor = -divisor;
+    }
+
+    int8_t row[MAX_KERNEL_SIZE];
+    int8_t col[MAX_KERNEL_SIZE];
+
+    for (i = 0; i < n; ++i) {
+        int32_t coeff = kernel->coeffs[pivot_row * n + i] / divisor;
+
+        if (coeff < INT8_MIN || coeff > INT8_MAX) {
+            return false;
+        }
+        row[i] = coeff;
+    }
+    for (j = 0; j < n; ++j) {
+        int32_t multiple = kernel->coeffs[j * n + pivot_col] / row[pivot_col];
+
+        if (multiple < INT8_MIN || multiple > INT8_MAX) {
+            return false;
+        }
+        col[j] = multiple;
+        for (i = 0; i < n; ++i) {
+            if (kernel->coeffs[j * n + i] != col[j] * row[i]) {
+                return false;
+            }
+        }
+    }
+
+    memcpy(kernel->row, row, n);
+    memcpy(kernel->col, col, n);
+    kernel->separable = true;
+    return true;
+}
+
+typedef void (*conv_row_function)(const uint8_t *const *rows, uint8_t *dst,
+                                  int32_t width, const conv_kernel *kernel);
+
+/* Sums of the n taps of a row of the window, p on its left pixel and k on
+ * the coefficients of that row of the turned kernel, without loops */
+#define TAPS3(p, k) ((p)[0] * (k)[0] + (p)[1] * (k)[1] + (p)[2] * (k)[2])
+#define TAPS5(p, k) (TAPS3(p, k) + (p)[3] * (k)[3] + (p)[4] * (k)[4])
+#define TAPS7(p, k) (TAPS5(p, k) + (p)[5] * (k)[5] + (p)[6] * (k)[6])
+
+/* Same as fused multiply-adds into s, from the left pixel */
+#define FTAPS3(s, p, k) \
+    fmaf((p)[2], (k)[2], fmaf((p)[1], (k)[1], fmaf((p)[0], (k)[0], s)))
+#define FTAPS5(s, p, k) \
+    fmaf((p)[4], (k)[4], fmaf((p)[3], (k)[3], FTAPS3(s, p, k)))
+#define FTAPS7(s, p, k) \
+    fmaf((p)[6], (k)[6], fmaf((p)[5], (k)[5], FTAPS5(s, p, k)))
+
+/* The kernel turned by 180 degrees : taps[j * n + i] multiplies the pixel
+ * at x - radius + i of rows[j] */
+static void conv_taps(const conv_kernel *kernel, int32_t *taps)
+{
+    const int32_t last = kernel->size * kernel->size - 1;
+    int32_t k;
+
+    for (k = 0; k <= last; ++k) {
+        taps[k] = kernel->coeffs[last - k];
+    }
+}
+
+static void conv_taps_float(const conv_kernel *kernel, float *taps)
+{
+    const int32_t last = kernel->size * kernel->size - 1;
+    int32_t k;
+
+    for (k = 0; k <= last; ++k) {
+        taps[k] = kernel->fcoeffs[last - k];
+    }
+}
+
+/* Edge, ridge and sharpen kernels with their coefficients in the code */
+static void conv_row_edge(const uint8_t *const *rows, uint8_t *dst,
+                          int32_t width, const conv_kernel *kernel)
+{
+    const uint8_t *top = rows[0], *mid = rows[1], *bottom = rows[2];
+    int32_t x;
+
+    for (x = 1; x < width - 1; ++x) {
+        int32_t sum = top[x - 1] + top[x] + top[x + 1] +
+                      mid[x - 1] + mid[x + 1] +
+                      bottom[x - 1] + bottom[x] + bottom[x + 1] -
+                      8 * mid[x];
+
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+static void conv_row_ridge(const uint8_t *const *rows, uint8_t *dst,
+                           int32_t width, const conv_kernel *kernel)
+{
+    const uint8_t *top = rows[0], *mid = rows[1], *bottom = rows[2];
+    int32_t x;
+
+    for (x = 1; x < width - 1; ++x) {
+        int32_t sum = 4 * mid[x] - top[x] - mid[x - 1] - mid[x + 1] -
+                      bottom[x];
+
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+static void conv_row_sharpen(const uint8_t *const *rows, uint8_t *dst,
+                             int32_t width, const conv_kernel *kernel)
+{
+    const uint8_t *top = rows[0], *mid = rows[1], *bottom = rows[2];
+    int32_t x;
+
+    for (x = 1; x < width - 1; ++x) {
+        int32_t sum = 5 * mid[x] - top[x] - mid[x - 1] - mid[x + 1] -
+                      bottom[x];
+
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+static void conv_row_3(const uint8_t *const *rows, uint8_t *dst,
+                       int32_t width, const conv_kernel *kernel)
+{
+    int32_t k[KERNEL_SIZE_3 * KERNEL_SIZE_3];
+    int32_t x;
+
+    conv_taps(kernel, k);
+    for (x = 1; x < width - 1; ++x) {
+        int32_t sum = TAPS3(rows[0] + x - 1, k) +
+                      TAPS3(rows[1] + x - 1, k + 3) +
+                      TAPS3(rows[2] + x - 1, k + 6);
+
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+static void conv_row_5(const uint8_t *const *rows, uint8_t *dst,
+                       int32_t width, const conv_kernel *kernel)
+{
+    int32_t k[KERNEL_SIZE_5 * KERNEL_SIZE_5];
+    int32_t x;
+
+    conv_taps(kernel, k);
+    for (x = 2; x < width - 2; ++x) {
+        int32_t sum = TAPS5(rows[0] + x - 2, k) +
+                      TAPS5(rows[1] + x - 2, k + 5) +
+                      TAPS5(rows[2] + x - 2, k + 10) +
+                      TAPS5(rows[3] + x - 2, k + 15) +
+                      TAPS5(rows[4] + x - 2, k + 20);
+
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+static void conv_row_7(const uint8_t *const *rows, uint8_t *dst,
+                       int32_t width, const conv_kernel *kernel)
+{
+    int32_t k[KERNEL_SIZE_7 * KERNEL_SIZE_7];
+    int32_t x;
+
+    conv_taps(kernel, k);
+    for (x = 3; x < width - 3; ++x) {
+        int32_t sum = TAPS7(rows[0] + x - 3, k) +
+                      TAPS7(rows[1] + x - 3, k + 7) +
+                      TAPS7(rows[2] + x - 3, k + 14) +
+                      TAPS7(rows[3] + x - 3, k + 21) +
+                      TAPS7(rows[4] + x - 3, k + 28) +
+                      TAPS7(rows[5] + x - 3, k + 35) +
+                      TAPS7(rows[6] + x - 3, k + 42);
+
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+/* Inner pixels of conv_row() for the other sizes */
+static void conv_row_n(const uint8_t *const *rows, uint8_t *dst,
+                       int32_t width, const conv_kernel *kernel)
+{
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+    int32_t x, i, j;
+
+    for (x = radius; x < width - radius; ++x) {
+        int32_t sum = 0;
+
+        /* Row y - j is rows[radius - j] */
+        for (j = -radius; j <= radius; ++j) {
+            const uint8_t *src = rows[radius - j];
+            const int8_t *coeffs = kernel->coeffs + (radius + j) * n + radius;
+
+            for (i = -radius; i <= radius; ++i) {
+                sum += src[x - i] * coeffs[i];
+            }
+        }
+        dst[x] = conv_normalize(sum, kernel->factor);
+    }
+}
+
+/* The float rows add the taps in the order of asm_conv_row_float_fma() */
+static void conv_row_float_3(const uint8_t *const *rows, uint8_t *dst,
+                             int32_t width, const conv_kernel *kernel)
+{
+    float k[KERNEL_SIZE_3 * KERNEL_SIZE_3];
+    int32_t x;
+
+    conv_taps_float(kernel, k);
+    for (x = 1; x < width - 1; ++x) {
+        float sum = 0;
+
+        sum = FTAPS3(sum, rows[0] + x - 1, k);
+        sum = FTAPS3(sum, rows[1] + x - 1, k + 3);
+        sum = FTAPS3(sum, rows[2] + x - 1, k + 6);
+        dst[x] = conv_normalize_float(sum, kernel->factor);
+    }
+}
+
+static void conv_row_float_5(const uint8_t *const *rows, uint8_t *dst,
+                             int32_t width, const conv_kernel *kernel)
+{
+    float k[KERNEL_SIZE_5 * KERNEL_SIZE_5];
+    int32_t x;
+
+    conv_taps_float(kernel, k);
+    for (x = 2; x < width - 2; ++x) {
+        float sum = 0;
+
+        sum = FTAPS5(sum, rows[0] + x - 2, k);
+        sum = FTAPS5(sum, rows[1] + x - 2, k + 5);
+        sum = FTAPS5(sum, rows[2] + x - 2, k + 10);
+        sum = FTAPS5(sum, rows[3] + x - 2, k + 15);
+        sum = FTAPS5(sum, rows[4] + x - 2, k + 20);
+        dst[x] = conv_normalize_float(sum, kernel->factor);
+    }
+}
+
+static void conv_row_float_7(const uint8_t *const *rows, uint8_t *dst,
+                             int32_t width, const conv_kernel *kernel)
+{
+    float k[KERNEL_SIZE_7 * KERNEL_SIZE_7];
+    int32_t x;
+
+    conv_taps_float(kernel, k);
+    for (x = 3; x < width - 3; ++x) {
+        float sum = 0;
+
+        sum = FTAPS7(sum, rows[0] + x - 3, k);
+        sum = FTAPS7(sum, rows[1] + x - 3, k + 7);
+        sum = FTAPS7(sum, rows[2] + x - 3, k + 14);
+        sum = FTAPS7(sum, rows[3] + x - 3, k + 21);
+        sum = FTAPS7(sum, rows[4] + x - 3, k + 28);
+        sum = FTAPS7(sum, rows[5] + x - 3, k + 35);
+        sum = FTAPS7(sum, rows[6] + x - 3, k + 42);
+        dst[x] = conv_normalize_float(sum, kernel->factor);
+    }
+}
+
+static void conv_row_float_n(const uint8_t *const *rows, uint8_t *dst,
+                             int32_t width, const conv_kernel *kernel)
+{
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+    int32_t x, i, j;
+
+    for (x = radius; x < width - radius; ++x) {
+        float sum = 0;
+
+        /* From the top left pixel, as asm_conv_row_float_fma() */
+        for (j = radius; j >= -radius; --j) {
+            const uint8_t *src = rows[radius - j];
+            const float *coeffs = kernel->fcoeffs + (radius + j) * n + radius;
+
+            for (i = radius; i >= -radius; --i) {
+                sum = fmaf(src[x - i], coeffs[i], sum);
+            }
+        }
+        dst[x] = conv_normalize_float(sum, kernel->factor);
+    }
+}
+
+static conv_row_function conv_row_float_c(const conv_kernel *kernel)
+{
+    switch (kernel->size) {
+    case KERNEL_SIZE_3: return conv_row_float_3;
+    case KERNEL_SIZE_5: return conv_row_float_5;
+    case KERNEL_SIZE_7: return conv_row_float_7;
+    default:            return conv_row_float_n;
+    }
+}
+
+static void conv_row_sse2(const uint8_t *const *rows, uint8_t *dst,
+                          int32_t width, const conv_kernel *kernel)
+{
+    asm_filter_row_sse2((uint8_t *)rows[0], (uint8_t *)rows[1],
+                        (uint8_t *)rows[2], dst, width, kernel->coeffs);
+}
+
+static void conv_row_avx2(const uint8_t *const *rows, uint8_t *dst,
+                          int32_t width, const conv_kernel *kernel)
+{
+    asm_filter_row_avx2((uint8_t *)rows[0], (uint8_t *)rows[1],
+                        (uint8_t *)rows[2], dst, width, kernel->coeffs);
+}
+
+/* asm_conv_row_float_fma() can run */
+static bool conv_float_simd(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+/* Float kernels on AVX2 and FMA, the narrow rows in C */
+static void conv_row_float_fma(const uint8_t *const *rows, uint8_t *dst,
+                               int32_t width, const conv_kernel *kernel)
+{
+    const conv_float_params params = {
+        .size = kernel->size, .factor = kernel->factor, .scale = 1.0f,
+        .max = UCHAR_MAX, .out16 = false
+    };
+
+    if (width - kernel->size + 1 < CONV_FLOAT_MIN_SIMD_PIXELS) {
+        conv_row_float_c(kernel)(rows, dst, width, kernel);
+        return;
+    }
+    asm_conv_row_float_fma(rows, dst, width, kernel->fcoeffs, &params);
+}
+
+/* The SIMD rows give the same result as conv_row_3() without factor.
+ * The reference kernels stay on the C rows */
+static bool conv_row_simd(const conv_kernel *kernel)
+{
+    return !kernel->reference && !kernel->fcoeffs &&
+           kernel->size == KERNEL_SIZE_3 && kernel->factor == 1;
+}
+
+static conv_row_function conv_row_select(const conv_kernel *kernel)
+{
+    if (kernel->fcoeffs) {
+        return conv_float_simd() ? conv_row_float_fma :
+                                   conv_row_float_c(kernel);
+    }
+
+    if (conv_row_simd(kernel)) {
+        return __builtin_cpu_supports("avx2") ? conv_row_avx2 : conv_row_sse2;
+    }
+
+    if (kernel->size == KERNEL_SIZE_3) {
+        if (kernel->coeffs == edge_detection_3x3) {
+            return conv_row_edge;
+        }
+        if (kernel->coeffs == ridge_detection_3x3) {
+            return conv_row_ridge;
+        }
+        if (kernel->coeffs == sharpen_3x3) {
+            return conv_row_sharpen;
+        }
+    }
+
+    switch (kernel->size) {
+    case KERNEL_SIZE_3: return conv_row_3;
+    case KERNEL_SIZE_5: return conv_row_5;
+    case KERNEL_SIZE_7: return conv_row_7;
+    default:            return conv_row_n;
+    }
+}
+
+void conv_row(const uint8_t *const *rows, uint8_t *dst, int32_t width,
+              const conv_kernel *kernel)
+{
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+
+    if (width < n) {
+        memcpy(dst, rows[radius], width);
+        return;
+    }
+    memcpy(dst, rows[radius], radius);
+    memcpy(dst + width - radius, rows[radius] + width - radius, radius);
+
+    conv_row_select(kernel)(rows, dst, width, kernel);
+}
+
+static void conv_padded_rows(const image_container *src, image_container *dst,
+                             const conv_kernel *kernel,
+                             const conv_border *border,
+                             int32_t y_start, int32_t y_end);
+
+void conv_rows(const image_container *src, image_container *dst,
+               const conv_kernel *kernel, const conv_border *border,
+               int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    const int32_t radius = kernel->size / 2;
+    const uint8_t *rows[MAX_KERNEL_SIZE];
+    int32_t y, j;
+
+    if (border->mode != BORDER_COPY) {
+        conv_padded_rows(src, dst, kernel, border, y_start, y_end);
+        return;
+    }
+
+    /* The 3x3 SIMD rows are faster than the two separable passes */
+    if (kernel->separable && !conv_row_simd(kernel)) {
+        conv_separable_rows(src, dst, kernel, y_start, y_end);
+        return;
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *src_row = image_row(src, y);
+        uint8_t *dst_row = image_row(dst, y);
+
+        /* If we are on the edges we keep the row as is */
+        if (y < radius || y >= src->height - radius) {
+            memcpy(dst_row, src_row, width);
+            continue;
+        }
+
+        for (j = 0; j < kernel->size; ++j) {
+            rows[j] = src_row + (ptrdiff_t)(j - radius) * src->stride;
+        }
+        conv_row(rows, dst_row, width, kernel);
+    }
+}
+
+/* Horizontal pass of one row : hrow[x] for the pixels that are not on the
+ * left or right border */
+static void horizontal_pass(const uint8_t *src, int32_t *hrow,
+                            int32_t width, const conv_kernel *kernel)
+{
+    const int32_t radius = kernel->size / 2;
+    int32_t x, i;
+
+    for (x = radius; x < width - radius; ++x) {
+        int32_t sum = 0;
+
+        /* Flipped kernel as in the 2D convolution */
+        for (i = -radius; i <= radius; ++i) {
+            sum += src[x - i] * kernel->row[radius + i];
+        }
+        hrow[x] = sum;
+    }
+}
+
+void conv_separable_rows(const image_container *src, image_container *dst,
+                         const conv_kernel *kernel,
+                         int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    const int32_t height = src->height;
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+    int32_t *ring;
+    int32_t x, y, j, next_row;
+
+    /* Ring of the horizontal pass results of the last n rows */
+    ring = malloc((size_t)n * width * sizeof (int32_t));
+    if (!ring) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    next_row = -1;
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *src_row = image_row(src, y);
+        uint8_t *dst_row = image_row(dst, y);
+
+        /* Border rows and columns are copied */
+        if (y < radius || y >= height - radius || width < n) {
+            memcpy(dst_row, src_row, width);
+            continue;
+        }
+        memcpy(dst_row, src_row, radius);
+        memcpy(dst_row + width - radius, src_row + width - radius, radius);
+
+        /* Horizontal pass of the rows that entered the window */
+        if (next_row < y - radius) {
+            next_row = y - radius;
+        }
+        for (; next_row <= y + radius; ++next_row) {
+            horizontal_pass(image_row(src, next_row),
+                            ring + (size_t)(next_row % n) * width,
+                            width, kernel);
+        }
+
+        /* Vertical pass */
+        for (x = radius; x < width - radius; ++x) {
+            int32_t sum = 0;
+
+            for (j = -radius; j <= radius; ++j) {
+                sum += ring[(size_t)((y - j) % n) * width + x] *
+                       kernel->col[radius + j];
+            }
+            dst_row[x] = conv_normalize(sum, kernel->factor);
+        }
+    }
+
+    free(ring);
+}
+
+/* Copies the row v, which may be outside of the image, to padded with
+ * radius border pixels on each side */
+static void pad_row(const image_container *src, uint8_t *padded, int32_t v,
+                    int32_t radius, const conv_border *border)
+{
+    const int32_t width = src->width;
+    const int32_t y = border_index(v, src->height, border->mode);
+    const uint8_t *row;
+    int32_t i;
+
+    if (y < 0) {
+        memset(padded, border->value, width + 2 * radius);
+        return;
+    }
+
+    row = image_row(src, y);
+    memcpy(padded + radius, row, width);
+    for (i = 1; i <= radius; ++i) {
+        int32_t left = border_index(-i, width, border->mode);
+        int32_t right = border_index(width - 1 + i, width, border->mode);
+
+        padded[radius - i] = left < 0 ? border->value : row[left];
+        padded[radius + width - 1 + i] = right < 0 ? border->value :
+                                                     row[right];
+    }
+}
+
+/* conv_rows() with a border mode other than BORDER_COPY
+ * The padded rows of the window are kept in a ring, row v in the slot
+ * (v - first) % n where first is the top row of the first window. The
+ * row functions then see an image radius pixels wider on each side and
+ * have no border to copy */
+static void conv_padded_rows(const image_container *src, image_container *dst,
+                             const conv_kernel *kernel,
+                             const conv_border *border,
+                             int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+    const int32_t padded_width = width + 2 * radius;
+    const int32_t first = y_start - radius;
+    const bool separable = kernel->separable && !conv_row_simd(kernel);
+    const conv_row_function row_function = conv_row_select(kernel);
+    const uint8_t *rows[MAX_KERNEL_SIZE];
+    uint8_t *ring, *out;
+    int32_t *hring = NULL;
+    int32_t x, y, j, next_row;
+
+    ring = malloc((size_t)n * padded_width);
+    out = malloc(padded_width);
+    if (separable) {
+        hring = malloc((size_t)n * padded_width * sizeof (int32_t));
+    }
+    if (!ring || !out || (separable && !hring)) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    next_row = first;
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *dst_row = image_row(dst, y);
+
+        /* Rows that entered the window */
+        for (; next_row <= y + radius; ++next_row) {
+            const size_t slot = (size_t)((next_row - first) % n);
+
+            pad_row(src, ring + slot * padded_width, next_row, radius, border);
+            if (separable) {
+                horizontal_pass(ring + slot * padded_width,
+                                hring + slot * padded_width,
+                                padded_width, kernel);
+            }
+        }
+
+        if (separable) {
+            for (x = 0; x < width; ++x) {
+                int32_t sum = 0;
+
+                for (j = -radius; j <= radius; ++j) {
+                    sum += hring[(size_t)((y - j - first) % n) *
+                                 padded_width + x + radius] *
+                           kernel->col[radius + j];
+                }
+                dst_row[x] = conv_normalize(sum, kernel->factor);
+            }
+            continue;
+        }
+
+        for (j = 0; j < n; ++j) {
+            rows[j] = ring + (size_t)((y - radius + j - first) % n) *
+                             padded_width;
+        }
+        row_function(rows, out, padded_width, kernel);
+        memcpy(dst_row, out + radius, width);
+    }
+
+    free(ring);
+    free(out);
+    free(hring);
+}
+
+/* Float convolution of a row into 16 bits pixels, same terms as
+ * conv_row() */
+static void conv_row16(const uint8_t *const *rows, uint16_t *dst,
+                       int32_t width, const float *coeffs,
+                       const conv_float_params *params)
+{
+    const int32_t n = params->size;
+    const int32_t radius = n / 2;
+    const uint8_t *mid = rows[radius];
+    int32_t x, i, j;
+
+    if (width < n) {
+        for (x = 0; x < width; ++x) {
+            dst[x] = mid[x] << CONV_WIDE_SHIFT;
+        }
+        return;
+    }
+    for (x = 0; x < radius; ++x) {
+        dst[x] = mid[x] << CONV_WIDE_SHIFT;
+        dst[width - 1 - x] = mid[width - 1 - x] << CONV_WIDE_SHIFT;
+    }
+
+    if (width - n + 1 >= CONV_FLOAT_MIN_SIMD_PIXELS && conv_float_simd()) {
+        asm_conv_row_float_fma(rows, dst, width, coeffs, params);
+        return;
+    }
+
+    for (x = radius; x < width - radius; ++x) {
+        /* The coefficients from the last, as asm_conv_row_float_fma() */
+        const float *coeff = coeffs + n * n - 1;
+        float sum = 0;
+
+        for (j = 0; j < n; ++j) {
+            for (i = -radius; i <= radius; ++i) {
+                sum = fmaf(rows[j][x + i], *coeff--, sum);
+            }
+        }
+        sum = fabsf(sum / params->factor) * params->scale;
+        dst[x] = !(sum <= params->max) ? params->max : sum;
+    }
+}
+
+void conv_rows16(const image_container *src, uint16_t *dst,
+                 int32_t dst_stride, const conv_kernel *kernel,
+                 const conv_border *border, int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+    const int32_t padded_width = width + 2 * radius;
+    const int32_t first = y_start - radius;
+    const conv_float_params params = {
+        .size = n, .factor = kernel->factor,
+        .scale = 1 << CONV_WIDE_SHIFT, .max = UINT16_MAX, .out16 = true
+    };
+    float int_coeffs[MAX_KERNEL_SIZE * MAX_KERNEL_SIZE];
+    const float *coeffs = kernel->fcoeffs;
+    const uint8_t *rows[MAX_KERNEL_SIZE];
+    uint8_t *ring;
+    uint16_t *out;
+    int32_t x, y, j, next_row;
+
+    if (!coeffs) {
+        for (j = 0; j < n * n; ++j) {
+            int_coeffs[j] = kernel->coeffs[j];
+        }
+        coeffs = int_coeffs;
+    }
+
+    if (border->mode == BORDER_COPY) {
+        for (y = y_start; y < y_end; ++y) {
+            const uint8_t *src_row = image_row(src, y);
+            uint16_t *dst_row = dst + (size_t)y * dst_stride;
+
+            /* If we are on the edges we keep the row as is */
+            if (y < radius || y >= src->height - radius) {
+                for (x = 0; x < width; ++x) {
+                    dst_row[x] = src_row[x] << CONV_WIDE_SHIFT;
+                }
+                continue;
+            }
+            for (j = 0; j < n; ++j) {
+                rows[j] = src_row + (ptrdiff_t)(j - radius) * src->stride;
+            }
+            conv_row16(rows, dst_row, width, coeffs, &params);
+        }
+        return;
+    }
+
+    /* Padded rows in a ring, as conv_padded_rows() */
+    ring = malloc((size_t)n * padded_width);
+    out = malloc(padded_width * sizeof (uint16_t));
+    if (!ring || !out) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    next_row = first;
+    for (y = y_start; y < y_end; ++y) {
+        for (; next_row <= y + radius; ++next_row) {
+            pad_row(src, ring + (size_t)((next_row - first) % n) *
+                         padded_width, next_row, radius, border);
+        }
+        for (j = 0; j < n; ++j) {
+            rows[j] = ring + (size_t)((y - radius + j - first) % n) *
+                             padded_width;
+        }
+        conv_row16(rows, out, padded_width, coeffs, &params);
+        memcpy(dst + (size_t)y * dst_stride, out + radius,
+               width * sizeof (uint16_t));
+    }
+
+    free(ring);
+    free(out);
+}
@@ -0,0 +1,185 @@
+/*
+ * File      : convolution.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Convolution engine working on bands of rows of grayscale images
+ */
+
+#ifndef __CONVOLUTION_H__
+#define __CONVOLUTION_H__
+
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "image_processing.h"
+#include "kernels.h"
+
+/* Border modes, the value used for a pixel outside of the image */
+#define BORDER_COPY     0 /* None, the pixels closer than the kernel radius
+                           * to the edges are copied */
+#define BORDER_CLAMP    1 /* Nearest edge pixel      aaa|abcd|ddd */
+#define BORDER_MIRROR   2 /* Reflection on the edge   cb|abcd|cb  */
+#define BORDER_WRAP     3 /* Opposite side            cd|abcd|ab  */
+#define BORDER_CONSTANT 4 /* Value of the border      vv|abcd|vv  */
+
+typedef struct {
+    int mode;
+    uint8_t value;    /* BORDER_CONSTANT */
+} conv_border;
+
+/* Index in [0, size[ of the pixel used for the index i with the border
+ * mode, -1 when i is outside and the mode is BORDER_CONSTANT */
+static inline int32_t border_index(int32_t i, int32_t size, int mode)
+{
+    int32_t period;
+
+    if (i >= 0 && i < size) {
+        return i;
+    }
+
+    switch (mode) {
+    case BORDER_CLAMP:
+        return i < 0 ? 0 : size - 1;
+    case BORDER_MIRROR:
+        if (size == 1) {
+            return 0;
+        }
+        period = 2 * size - 2;
+        i %= period;
+        if (i < 0) {
+            i += period;
+        }
+        return i < size ? i : period - i;
+    case BORDER_WRAP:
+        i %= size;
+        return i < 0 ? i + size : i;
+    default:
+        return -1;
+    }
+}
+
+/* Pixel at x,y of a grayscale image, which may be outside of it */
+static inline uint8_t border_pixel(const image_container *img,
+                                   int32_t x, int32_t y,
+                                   const conv_border *border)
+{
+    x = border_index(x, img->width, border->mode);
+    y = border_index(y, img->height, border->mode);
+    if (x < 0 || y < 0) {
+        return border->value;
+    }
+    return image_row(img, y)[x];
+}
+
+/* Reads a border mode : copy, clamp, mirror, wrap or constant[:value].
+ * Returns false when the mode is unknown */
+bool conv_border_parse(const char *arg, conv_border *border);
+
+/* Converts a convolution sum to a pixel : division by the kernel factor,
+ * absolute value and saturation to 255 */
+static inline uint8_t conv_normalize(int32_t sum, int32_t factor)
+{
+    if (factor != 1) {
+        sum /= factor;
+    }
+    sum = abs(sum);
+    if (sum > UCHAR_MAX) {
+        sum = UCHAR_MAX;
+    }
+    return sum;
+}
+
+/* Same for the sum of a float kernel, the result is truncated.
+ * The sums are fused multiply-adds from the top left pixel of the window
+ * (the kernel turned by 180 degrees) in C as in asm_conv_row_float_fma(),
+ * each one rounded once, so every path and CPU gives the same pixels */
+static inline uint8_t conv_normalize_float(float sum, int32_t factor)
+{
+    sum = fabsf(sum / factor);
+    /* A NaN sum (infinite products of opposite signs) saturates too, as
+     * with vminps */
+    if (!(sum <= UCHAR_MAX)) {
+        return UCHAR_MAX;
+    }
+    return sum;
+}
+
+/* 3x3 SIMD convolution of a row given by the rows y - 1, y and y + 1,
+ * the factor is not applied (see asm_filter_image.S). The student's filter,
+ * also run by conv_row() except for the reference kernels */
+extern void asm_filter_row_sse2(uint8_t *top, uint8_t *mid, uint8_t *bottom,
+                                uint8_t *dest, int32_t width,
+                                int8_t *kernel);
+extern void asm_filter_row_avx2(uint8_t *top, uint8_t *mid, uint8_t *bottom,
+                                uint8_t *dest, int32_t width,
+                                int8_t *kernel);
+
+/* Float convolution of the rows wider than this, with AVX2 and FMA.
+ * The other ones run the C loops */
+#define CONV_FLOAT_MIN_SIMD_PIXELS 8
+/* 16 bits pixels keep 8 bits of fraction : 8.8 fixed point */
+#define CONV_WIDE_SHIFT 8
+
+/* Normalization of the sums of the float convolution, see
+ * asm_conv_float.S */
+typedef struct {
+    int32_t size;     /* Of the kernel */
+    int32_t factor;   /* The sum is divided by it (not when it is 1) */
+    float scale;      /* then its absolute value multiplied by it */
+    float max;        /* and saturated to it */
+    int32_t out16;    /* uint16_t pixels instead of uint8_t */
+} conv_float_params;
+
+/* Float convolution of the pixels radius to width - radius - 1 of a row,
+ * rows[j] is the row y - radius + j and coeffs the size x size floats of
+ * the kernel. At least CONV_FLOAT_MIN_SIMD_PIXELS pixels are written */
+extern void asm_conv_row_float_fma(const uint8_t *const *rows, void *dst,
+                                   int32_t width, const float *coeffs,
+                                   const conv_float_params *params);
+
+/* Looks for integer row and column vectors so that the kernel is
+ * col x row, fills them and sets kernel->separable when found.
+ * Returns kernel->separable */
+bool kernel_separate(conv_kernel *kernel);
+
+/* Convolution of one row, rows[j] is the source row y - radius + j.
+ * The left and right border pixels are copied.
+ * The float kernels run on asm_conv_row_float_fma() when the CPU has
+ * AVX2 and FMA, the 3x3 int8 kernels without factor on
+ * asm_filter_row_sse2() or asm_filter_row_avx2(). The reference kernels
+ * and the other ones run C rows : the edge, ridge and sharpen kernels
+ * with their coefficients in the code, the other sizes 3, 5 and 7
+ * unrolled and the larger ones in loops */
+void conv_row(const uint8_t *const *rows, uint8_t *dst, int32_t width,
+              const conv_kernel *kernel);
+
+/* Convolution of the rows [y_start, y_end[ of src into dst with the
+ * fastest of conv_row() and conv_separable_rows() for the kernel.
+ * Except for BORDER_COPY, the rows are first copied with radius border
+ * pixels on each side, so every pixel runs the same loop as the inner
+ * ones. Same result as border_pixel() for the pixels outside */
+void conv_rows(const image_container *src, image_container *dst,
+               const conv_kernel *kernel, const conv_border *border,
+               int32_t y_start, int32_t y_end);
+
+/* conv_rows() with 16 bits destination pixels, dst_stride pixels from
+ * a row to the next : the absolute value of the sum divided by the
+ * factor, shifted left by CONV_WIDE_SHIFT and saturated to UINT16_MAX.
+ * The copied border pixels are shifted too. The int8 kernels run as
+ * float ones */
+void conv_rows16(const image_container *src, uint16_t *dst,
+                 int32_t dst_stride, const conv_kernel *kernel,
+                 const conv_border *border, int32_t y_start, int32_t y_end);
+
+/* Separable convolution of the rows [y_start, y_end[ of src into dst,
+ * with a horizontal pass followed by a vertical pass.
+ * Same result as the 2D convolution, border pixels are copied */
+void conv_separable_rows(const image_container *src, image_container *dst,
+                         const conv_kernel *kernel,
+                         int32_t y_start, int32_t y_end);
+
+#endif /* __CONVOLUTION_H__ */
@@ -0,0 +1,186 @@
+/*
+ * File      : gradient.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _DEFAULT_SOURCE /* strdup() and strtok_r() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gradient.h"
+#include "thread_pool.h"
+
+/* Narrower rows are done in C, see asm_gradient.S */
+#define GRADIENT_MIN_SIMD_WIDTH 10
+/* tan(22.5 degrees) in 0.16 fixed point and the scale of |Gx| and |Gy|
+ * compared with it, same as asm_gradient.S */
+#define GRADIENT_TAN_22_5   27146
+#define GRADIENT_SCALE_SHIFT 3
+
+/* Magnitude and orientation of the pixels 1 to width - 2 of a row */
+extern void asm_gradient_row_sse2(const uint8_t *top, const uint8_t *mid,
+                                  const uint8_t *bottom, uint8_t *mag,
+                                  uint8_t *dir, int32_t width,
+                                  const gradient_op *op);
+
+typedef struct {
+    const image_container *src;
+    image_container *mag;
+    image_container *dir;
+    const gradient_op *op;
+} gradient_args;
+
+bool gradient_parse(const char *arg, gradient_filter *grad)
+{
+    char *copy = strdup(arg), *token, *save;
+    bool valid = copy != NULL;
+
+    grad->l2 = false;
+    grad->orientation = false;
+
+    token = valid ? strtok_r(copy, ":", &save) : NULL;
+    if (token && !strcmp(token, "sobel")) {
+        grad->op = GRADIENT_SOBEL;
+    } else if (token && !strcmp(token, "scharr")) {
+        grad->op = GRADIENT_SCHARR;
+    } else {
+        valid = false;
+    }
+
+    while (valid && (token = strtok_r(NULL, ":", &save))) {
+        if (!strcmp(token, "l1")) {
+            grad->l2 = false;
+        } else if (!strcmp(token, "l2")) {
+            grad->l2 = true;
+        } else if (!strcmp(token, "dir")) {
+            grad->orientation = true;
+        } else {
+            valid = false;
+        }
+    }
+
+    free(copy);
+    return valid;
+}
+
+/* Same as asm_gradient_row_sse2() for one pixel */
+static void gradient_pixel(const uint8_t *t, const uint8_t *m,
+                           const uint8_t *b, int32_t x, uint8_t *mag,
+                           uint8_t *dir, const gradient_op *op)
+{
+    const int32_t gx = op->side * ((t[x + 1] - t[x - 1]) +
+                                   (b[x + 1] - b[x - 1])) +
+                       op->center * (m[x + 1] - m[x - 1]);
+    const int32_t gy = op->side * ((b[x - 1] - t[x - 1]) +
+                                   (b[x + 1] - t[x + 1])) +
+                       op->center * (b[x] - t[x]);
+    const int32_t ax = abs(gx), ay = abs(gy);
+    int32_t value, high, low;
+
+    if (op->l2) {
+        high = ax > ay ? ax : ay;
+        low = ax > ay ? ay : ax;
+        value = high + (low >> 2) + (low >> 3);
+    } else {
+        value = ax + ay;
+    }
+    value >>= op->shift;
+    mag[x] = value > UINT8_MAX ? UINT8_MAX : value;
+
+    if (!dir) {
+        return;
+    }
+    high = ax << GRADIENT_SCALE_SHIFT;
+    low = ay << GRADIENT_SCALE_SHIFT;
+    if (low <= (high * GRADIENT_TAN_22_5) >> 16) {
+        dir[x] = GRADIENT_DIR_0;
+    } else if (high < (low * GRADIENT_TAN_22_5) >> 16) {
+        dir[x] = GRADIENT_DIR_90;
+    } else {
+        dir[x] = (gx ^ gy) < 0 ? GRADIENT_DIR_135 : GRADIENT_DIR_45;
+    }
+}
+
+void gradient_rows(const image_container *src, image_container *mag,
+                   image_container *dir, const gradient_op *op,
+                   int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    int32_t x, y;
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *mid = image_row(src, y);
+        uint8_t *mag_row = image_row(mag, y);
+        uint8_t *dir_row = dir ? image_row(dir, y) : NULL;
+
+        /* No gradient on the edges */
+        if (y == 0 || y == src->height - 1 || width < 3) {
+            memset(mag_row, 0, width);
+            if (dir_row) {
+                memset(dir_row, GRADIENT_DIR_0, width);
+            }
+            continue;
+        }
+        mag_row[0] = mag_row[width - 1] = 0;
+        if (dir_row) {
+            dir_row[0] = dir_row[width - 1] = GRADIENT_DIR_0;
+        }
+
+        if (width >= GRADIENT_MIN_SIMD_WIDTH) {
+            asm_gradient_row_sse2(mid - src->stride, mid, mid + src->stride,
+                                  mag_row, dir_row, width, op);
+            continue;
+        }
+        for (x = 1; x < width - 1; ++x) {
+            gradient_pixel(mid - src->stride, mid, mid + src->stride, x,
+                           mag_row, dir_row, op);
+        }
+    }
+}
+
+static void gradient_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    gradient_args *args = arg;
+
+    gradient_rows(args->src, args->mag, args->dir, args->op,
+                  y_start, y_end);
+}
+
+image_container *gradient(const image_container *img,
+                          const gradient_filter *grad,
+                          image_container **dir)
+{
+    /* The Scharr weights add up to 4 times the Sobel ones, the shift
+     * keeps the magnitudes in the same range */
+    const gradient_op op = {
+        .side = grad->op == GRADIENT_SCHARR ? 3 : 1,
+        .center = grad->op == GRADIENT_SCHARR ? 10 : 2,
+        .shift = grad->op == GRADIENT_SCHARR ? 2 : 0,
+        .l2 = grad->l2
+    };
+    gradient_args args = { .src = img, .op = &op };
+
+    if (img->comp != COMPONENT_GRAYSCALE) {
+        fprintf(stderr, "[%s] only accepts grayscale images\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    args.mag = allocate_container(img->width, img->height,
+                                  COMPONENT_GRAYSCALE);
+    if (dir) {
+        args.dir = *dir = allocate_container(img->width, img->height,
+                                             COMPONENT_GRAYSCALE);
+    }
+    thread_pool_run(gradient_band, &args, img->height,
+                    thread_pool_band_rows((dir ? 3 : 2) * (size_t)img->width,
+                                          1));
+    return args.mag;
+}
@@ -0,0 +1,61 @@
+/*
+ * File      : gradient.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Sobel and Scharr gradients in one pass : Gx and Gy are computed
+ * together from the same neighbourhood, then the magnitude and the
+ * quantized orientation, with SSE2 (see asm_gradient.S).
+ */
+
+#ifndef __GRADIENT_H__
+#define __GRADIENT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+
+/* Operators */
+#define GRADIENT_SOBEL  0 /* 1 2 1 */
+#define GRADIENT_SCHARR 1 /* 3 10 3 */
+
+/* Orientations of the gradient, y down. The pixels without gradient
+ * are GRADIENT_DIR_0 */
+#define GRADIENT_DIR_0   0 /* Along x, vertical edge */
+#define GRADIENT_DIR_45  1
+#define GRADIENT_DIR_90  2 /* Along y, horizontal edge */
+#define GRADIENT_DIR_135 3
+
+/* Parameters of asm_gradient_row_sse2(), in 16 bits for the words */
+typedef struct {
+    int16_t side;    /* Weight of the corners */
+    int16_t center;  /* Weight of the middle */
+    int16_t shift;   /* The magnitude is divided by 1 << shift */
+    int16_t l2;      /* max + 3/8 min instead of |Gx| + |Gy| */
+} gradient_op;
+
+typedef struct {
+    int op;
+    bool l2;          /* Magnitude close to the L2 norm */
+    bool orientation; /* The orientation is wanted too */
+} gradient_filter;
+
+/* Reads sobel or scharr, followed by :l1 (default) or :l2 and :dir for
+ * the orientation. Returns false when it is not valid */
+bool gradient_parse(const char *arg, gradient_filter *grad);
+
+/* Gradient of the rows [y_start, y_end[ of src into the magnitude mag
+ * and the orientation dir (NULL : none). The pixels on the edges of the
+ * image have no gradient, they are 0 */
+void gradient_rows(const image_container *src, image_container *mag,
+                   image_container *dir, const gradient_op *op,
+                   int32_t y_start, int32_t y_end);
+
+/* Magnitude of the gradient of a grayscale image and, when dir is not
+ * NULL, its orientation (GRADIENT_DIR_*). On the thread pool */
+image_container *gradient(const image_container *img,
+                          const gradient_filter *grad,
+                          image_container **dir);
+
+#endif /* __GRADIENT_H__ */
@@ -0,0 +1,264 @@
+/*
+ * File      : histogram.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "thread_pool.h"
+
+/* Histogram of size bytes into HIST_SUBS sub-histograms, see
+ * asm_histogram.S */
+extern void asm_histogram_sse2(const uint8_t *data, int32_t size,
+                               uint32_t *hists);
+
+typedef struct {
+    image_container *img;
+    const uint8_t *lut;
+    uint64_t *count;
+} hist_args;
+
+bool hist_parse(const char *arg, hist_stage *stage)
+{
+    char end;
+
+    stage->clip = 0.0;
+    if (!strcmp(arg, "stats")) {
+        stage->op = HIST_STATS;
+        return true;
+    }
+    if (!strcmp(arg, "equalize")) {
+        stage->op = HIST_EQUALIZE;
+        return true;
+    }
+    if (strncmp(arg, "levels", 6)) {
+        return false;
+    }
+    stage->op = HIST_LEVELS;
+    if (!arg[6]) {
+        return true;
+    }
+    return arg[6] == ':' &&
+           sscanf(arg + 7, "%lf%c", &stage->clip, &end) == 1 &&
+           stage->clip >= 0.0 && stage->clip <= HIST_MAX_CLIP;
+}
+
+void histogram_rows(const image_container *img, uint32_t *hists,
+                    int32_t y_start, int32_t y_end)
+{
+    const size_t row_size = (size_t)img->width * img->comp;
+    int32_t y;
+
+    for (y = y_start; y < y_end; ++y) {
+        asm_histogram_sse2(image_row(img, y), row_size, hists);
+    }
+}
+
+/* The counters of a band fit in 32 bits, they are added to the ones of
+ * the image once the band is done. The alpha of RGBA images is counted
+ * apart and taken out */
+static void histogram_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    hist_args *args = arg;
+    const image_container *img = args->img;
+    uint32_t hists[HIST_SUBS * HIST_BINS] = { 0 };
+    uint32_t alpha[HIST_BINS] = { 0 };
+    int32_t x, y;
+    int v, s;
+
+    histogram_rows(img, hists, y_start, y_end);
+    if (img->comp == COMPONENT_RGBA) {
+        for (y = y_start; y < y_end; ++y) {
+            const uint8_t *row = image_row(img, y);
+
+            for (x = 0; x < img->width; ++x) {
+                ++alpha[row[x * COMPONENT_RGBA + A_OFFSET]];
+            }
+        }
+    }
+    for (v = 0; v < HIST_BINS; ++v) {
+        uint64_t sum = 0;
+
+        for (s = 0; s < HIST_SUBS; ++s) {
+            sum += hists[s * HIST_BINS + v];
+        }
+        sum -= alpha[v];
+        if (sum) {
+            __atomic_fetch_add(&args->count[v], sum, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void histogram_compute(const image_container *img, image_histogram *hist)
+{
+    hist_args args = { .img = (image_container *)img, .count = hist->count };
+    const size_t row_size = (size_t)img->width * img->comp;
+    double sum = 0.0, sum_sq = 0.0;
+    int v;
+
+    memset(hist, 0, sizeof (*hist));
+    thread_pool_run(histogram_band, &args, img->height,
+                    thread_pool_band_rows(row_size, 0));
+
+    /* All the statistics come from the 256 counters */
+    hist->min = UINT8_MAX;
+    for (v = 0; v < HIST_BINS; ++v) {
+        if (!hist->count[v]) {
+            continue;
+        }
+        if (v < hist->min) {
+            hist->min = v;
+        }
+        hist->max = v;
+        hist->total += hist->count[v];
+        sum += (double)v * hist->count[v];
+        sum_sq += (double)v * v * hist->count[v];
+    }
+    if (!hist->total) {
+        hist->min = 0;
+        return;
+    }
+    hist->mean = sum / hist->total;
+    hist->stddev = sqrt(fmax(sum_sq / hist->total - hist->mean * hist->mean,
+                             0.0));
+}
+
+static void lut_identity(uint8_t lut[HIST_BINS])
+{
+    int v;
+
+    for (v = 0; v < HIST_BINS; ++v) {
+        lut[v] = v;
+    }
+}
+
+/* The cumulative histogram, starting at the first value present, is
+ * spread over [0, 255] */
+void histogram_equalize_lut(const image_histogram *hist,
+                            uint8_t lut[HIST_BINS])
+{
+    const uint64_t first = hist->total ? hist->count[hist->min] : 0;
+    const uint64_t range = hist->total - first;
+    uint64_t cdf = 0;
+    int v;
+
+    if (!range) {
+        lut_identity(lut);
+        return;
+    }
+    for (v = 0; v < HIST_BINS; ++v) {
+        cdf += hist->count[v];
+        lut[v] = cdf <= first ? 0 :
+                 ((cdf - first) * UINT8_MAX + range / 2) / range;
+    }
+}
+
+/* Low and high are the values with clip percents of the pixels below
+ * and above them */
+void histogram_levels_lut(const image_histogram *hist, double clip,
+                          uint8_t lut[HIST_BINS])
+{
+    const uint64_t clipped = hist->total * clip / 100.0;
+    uint64_t below = 0, above = 0;
+    int low, high, v;
+
+    for (low = 0; low < UINT8_MAX; ++low) {
+        below += hist->count[low];
+        if (below > clipped) {
+            break;
+        }
+    }
+    for (high = UINT8_MAX; high > 0; --high) {
+        above += hist->count[high];
+        if (above > clipped) {
+            break;
+        }
+    }
+    if (high <= low) {
+        lut_identity(lut);
+        return;
+    }
+    for (v = 0; v < HIST_BINS; ++v) {
+        if (v <= low) {
+            lut[v] = 0;
+        } else if (v >= high) {
+            lut[v] = UINT8_MAX;
+        } else {
+            lut[v] = ((v - low) * UINT8_MAX + (high - low) / 2) /
+                     (high - low);
+        }
+    }
+}
+
+static void lut_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    hist_args *args = arg;
+    const size_t row_size = (size_t)args->img->width * args->img->comp;
+    const uint8_t *lut = args->lut;
+    uint8_t *data;
+    size_t i;
+    int32_t y;
+
+    for (y = y_start; y < y_end; ++y) {
+        data = image_row(args->img, y);
+
+        /* The alpha is left as it is */
+        if (args->img->comp == COMPONENT_RGBA) {
+            for (i = 0; i < row_size; i += COMPONENT_RGBA) {
+                data[i + R_OFFSET] = lut[data[i + R_OFFSET]];
+                data[i + G_OFFSET] = lut[data[i + G_OFFSET]];
+                data[i + B_OFFSET] = lut[data[i + B_OFFSET]];
+            }
+            continue;
+        }
+        for (i = 0; i + 4 <= row_size; i += 4) {
+            data[i] = lut[data[i]];
+            data[i + 1] = lut[data[i + 1]];
+            data[i + 2] = lut[data[i + 2]];
+            data[i + 3] = lut[data[i + 3]];
+        }
+        for (; i < row_size; ++i) {
+            data[i] = lut[data[i]];
+        }
+    }
+}
+
+void histogram_apply_lut(image_container *img, const uint8_t lut[HIST_BINS])
+{
+    hist_args args = { .img = img, .lut = lut };
+
+    thread_pool_run(lut_band, &args, img->height,
+                    thread_pool_band_rows((size_t)img->width * img->comp, 0));
+}
+
+void histogram_stage(image_container *img, const hist_stage *stage)
+{
+    image_histogram hist;
+    uint8_t lut[HIST_BINS];
+
+    histogram_compute(img, &hist);
+    fprintf(stdout, "[%s] min %d max %d mean %.2f stddev %.2f\n", __func__,
+            hist.min, hist.max, hist.mean, hist.stddev);
+
+    switch (stage->op) {
+    case HIST_EQUALIZE:
+        histogram_equalize_lut(&hist, lut);
+        break;
+    case HIST_LEVELS:
+        histogram_levels_lut(&hist, stage->clip, lut);
+        break;
+    default:
+        return;
+    }
+    histogram_apply_lut(img, lut);
+}
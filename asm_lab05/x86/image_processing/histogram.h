@@ -0,0 +1,73 @@
+/*
+ * File      : histogram.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Histogram and statistics of an image in one pass on the thread pool,
+ * and the tone stages built on it : histogram equalization and auto
+ * levels (contrast stretching), done in place with a lookup table.
+ */
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+
+#define HIST_BINS 256
+/* Sub-histograms of asm_histogram_sse2() */
+#define HIST_SUBS 4
+
+/* Stages */
+#define HIST_STATS    0 /* Statistics only */
+#define HIST_EQUALIZE 1 /* Flat histogram */
+#define HIST_LEVELS   2 /* Stretches [low, high] to [0, 255] */
+
+/* Maximum percentage of the pixels clipped at each end by the levels */
+#define HIST_MAX_CLIP 49.0
+
+/* Counts of all the components but the alpha and the statistics derived
+ * from them */
+typedef struct {
+    uint64_t count[HIST_BINS];
+    uint64_t total;
+    uint8_t min;
+    uint8_t max;
+    double mean;
+    double stddev;
+} image_histogram;
+
+/* Stage and percentage of the pixels clipped at each end by the levels */
+typedef struct {
+    int op;
+    double clip;
+} hist_stage;
+
+/* Reads stats, equalize or levels[:percent]. Returns false when it is
+ * not valid */
+bool hist_parse(const char *arg, hist_stage *stage);
+
+/* Adds the components of the rows [y_start, y_end[ to the HIST_SUBS
+ * sub-histograms hists (HIST_SUBS x HIST_BINS counters) */
+void histogram_rows(const image_container *img, uint32_t *hists,
+                    int32_t y_start, int32_t y_end);
+
+/* Histogram and statistics of the whole image, on the thread pool */
+void histogram_compute(const image_container *img, image_histogram *hist);
+
+/* Lookup tables of the equalization and of the levels */
+void histogram_equalize_lut(const image_histogram *hist,
+                            uint8_t lut[HIST_BINS]);
+void histogram_levels_lut(const image_histogram *hist, double clip,
+                          uint8_t lut[HIST_BINS]);
+
+/* Replaces every component of the image but the alpha by its entry of
+ * the table */
+void histogram_apply_lut(image_container *img, const uint8_t lut[HIST_BINS]);
+
+/* Prints the statistics of the image and applies the stage in place */
+void histogram_stage(image_container *img, const hist_stage *stage);
+
+#endif /* __HISTOGRAM_H__ */
@@ -11,62 +11,149 @@
  * ~ 80 Characters width
  */
 
+#define _DEFAULT_SOURCE /* opendir(), strdup() and strcasecmp() */
+
+#include <dirent.h>
 #include <getopt.h>
 #include <limits.h>
 #include <math.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
 
+#include "arena.h"
+#include "bench.h"
+#include "buffer_pool.h"
+#include "chain.h"
+#include "convolution.h"
+#include "gradient.h"
+#include "histogram.h"
 #include "image_processing.h"
+#include "integral.h"
 #include "kernels.h"
+#include "median.h"
+#include "morphology.h"
+#include "planar.h"
+#include "png_stream.h"
+#include "pyramid.h"
+#include "pnm.h"
+#include "thread_pool.h"
+#include "tiled.h"
+#include "trace.h"
+#include "video.h"
 
 /* Single-file public domain librairies for C/C++
    https://github.com/nothings/stb */
 #define STB_IMAGE_IMPLEMENTATION
 #include "lib/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "lib/stb_image_write.h"
 
+/* Source and destination of a stage run by bands of rows */
 typedef struct {
-    int width;
-    int height;
-    int comp; /* Number of components per pixel, eg RGB => 3 */
+    image_container *src;
+    image_container *dst;
+    const conv_kernel *kernel;
+    const conv_border *border;
+    const integral_image *integral;
+    uint16_t *wide;           /* 16 bits destination of filter_wide() */
+} band_args;
 
-    uint8_t *data;
-} image_container;
+/* Containers come from this arena instead of malloc() when it is set,
+ * they are then all released by arena_reset() */
+static buffer_arena *container_arena = NULL;
 
 /*************************
  * Function declarations *
  *************************/
 void print_usage();
-image_container *allocate_container(size_t width,
-                                    size_t height,
-                                    size_t comp);
-image_container *load_image(const char *src_img_path);
-image_container *grayscale_conversion(image_container *img);
-image_container *apply_filter(image_container *img);
-image_container *apply_filter_student(image_container *img);
-void save_image(const char *dest_img_path, const image_container *img);
-void free_container(image_container *img);
-char show_differences(image_container *imgA,
-                      image_container *imgB,
-		      bool list);
+static void grayscale_conversion_band(void *arg, int32_t y_start,
+                                      int32_t y_end);
+static void apply_filter_band(void *arg, int32_t y_start, int32_t y_end);
+static void apply_filter_student_band(void *arg, int32_t y_start,
+                                      int32_t y_end);
+static void apply_filter_student_fused_band(void *arg, int32_t y_start,
+                                            int32_t y_end);
+static void filter_row_student(uint8_t *top, uint8_t *mid, uint8_t *bottom,
+                               uint8_t *dest, int32_t width, int8_t *kernel);
+void stream_filter(const char *src_img_path, const char *dest_img_path);
+int batch_filter(const char *source, bool is_list, const char *dest_dir,
+                 bool external, bool show_error);
+static char batch_filter_image(const char *src_img_path, const char *dest_dir,
+                               bool external, bool show_error);
+static char **list_images(const char *source, bool is_list, int *count);
+static bool run_compare(const char *path_a, const char *path_b,
+                        const char *diff_path);
+static bool fused_student_supported(void);
+static void suffixed_path(char *path, const char *dest_img_path,
+                          const char *suffix, int index);
+static void save_orientation(const char *dest_img_path,
+                             image_container *dir);
+static void save_pyramid(const char *dest_img_path, const char *suffix,
+                         const image_pyramid *pyr);
+static void filter_color(image_container *img, const char *dest_img_path);
+static image_container *filter_frame(image_container *frame);
+static void filter_wide(image_container *img, const char *dest_img_path);
+static void filter_wide_band(void *arg, int32_t y_start, int32_t y_end);
+static uint64_t container_bytes(const image_container *img);
+static image_container *_apply_filter(image_container *img, bool reference);
+static char _show_differences(image_container *imgA,
+                              image_container *imgB, bool list);
 
 /* Filters */
 uint8_t median_filter_x_y(image_container *img, int32_t x, int32_t y);
 uint8_t conv_filter_x_y(image_container *img, int32_t x, int32_t y);
 //#define FILTER_TO_USE median_filter_x_y
 #define FILTER_TO_USE conv_filter_x_y
-#define KERNEL_3X3_TO_USE edge_detection_3x3
+#define KERNEL_TO_USE edge_detection
+#define MEDIAN_SHAPE MEDIAN_CROSS
+#define MEDIAN_RADIUS 1
 uint8_t (*filter_x_y) (image_container *img,
 		       int32_t x, int32_t y) = FILTER_TO_USE;
+/* Convolution kernel, can be changed with the -k and -K options */
+conv_kernel *kernel_to_use = &KERNEL_TO_USE;
+/* Border mode of the convolution, changed with the -b option */
+conv_border border_to_use = { BORDER_COPY, 0 };
+/* Radius of the box blur done with the integral image instead of the
+ * convolution, 0 : none. Set with the -r option */
+int32_t box_radius = 0;
+/* Window radius and k of the adaptive threshold done with the integral
+ * image instead of the convolution, 0 : none. Set with the -a option */
+int32_t threshold_radius = 0;
+float threshold_k = 0;
+/* Chain of filters run instead of the filter, NULL : none.
+ * Set with the -c option */
+filter_chain *chain_to_use = NULL;
+/* Morphology run instead of the filter, NULL : none.
+ * Set with the -m option */
+morph_filter *morph_to_use = NULL;
+/* Sobel or Scharr gradient magnitude instead of the filter, NULL : none.
+ * Set with the -g option */
+gradient_filter *gradient_to_use = NULL;
+/* Statistics, equalization or levels of the image before the filter,
+ * NULL : none. Set with the -e option */
+hist_stage *hist_to_use = NULL;
+/* Convolution of each plane of the color images instead of their
+ * grayscale conversion, set with the -C option */
+bool color_filter = false;
+/* Size of the preview filtered instead of the image, 0 : none.
+ * Set with the -D option */
+int32_t preview_width = 0;
+int32_t preview_height = 0;
+/* Convolution result in 16 bits per pixel, 8 of them after the point,
+ * instead of 8 bits. Set with the -w option */
+bool wide_output = false;
+/* Size of the raw images, set with the -R option */
+raw_geometry raw_input = { 0, 0, 0 };
+/* Compression level of the PNG files written, set with the -z option */
+int png_level = ZLIB_DEFAULT_LEVEL;
 
-/* External Assembly Function declaration */
-extern void asm_filter(uint8_t *src, uint8_t *dest,
-                       int32_t width, int32_t height,
-                       int32_t x, int32_t y);
+/* Fixed point grayscale conversion of a RGB or RGBA row */
+extern void asm_grayscale_row_ssse3(const uint8_t *src, uint8_t *dest,
+                                    int32_t width, int32_t comp);
 
 /********
  * MAIN *
@@ -74,26 +161,277 @@ extern void asm_filter(uint8_t *src, uint8_t *dest,
 int main(int argc, char **argv)
 {
   image_container *img, *img_grayscale, *img_result, *img_result_student;
-    char cmd[CMD_SIZE];
+    char cmd[PATH_SIZE + CMD_SIZE];
     bool show_error = false;
+    bool bench_mode = false;
+    bool stream_mode = false;
+    bool video_mode = false;
+    bool external = true;
     char *image_path = IMAGE_FILE;
+    char *result_path = RESULT_FILE;
+    char *batch_source = NULL;
+    bool batch_is_list = false;
+    char *dest_dir = ".";
+    conv_kernel *loaded_kernel = NULL;
+    char *chain_spec = NULL;
+    filter_chain chain;
+    morph_filter morph;
+    gradient_filter grad;
+    hist_stage hist;
+    char *raw_size = NULL;
+    int32_t tiled_cache = 0;
+    int32_t pyramid_levels = 0;
+    image_container *img_preview, *img_dir;
+    image_pyramid gauss, laplacian;
+    int nb_threads = 0;
     int option;
 
     /* Option handling */
-    while ((option = getopt(argc, argv,"f:s")) != -1) {
+    while ((option = getopt(argc, argv,"f:O:R:z:st:ST:d:l:o:nk:K:b:r:a:m:g:c:e:CD:P:BVj:w")) != -1) {
         switch (option) {
 	    case 'f' : image_path = optarg;
                break;
+	    case 'O' : result_path = optarg;
+               break;
+	    case 'z' : png_level = atoi(optarg);
+                if (png_level < 0 || png_level > 9) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'R' : raw_size = optarg;
+                break;
 	    case 's' : show_error = true;
                 break;
+	    case 't' : nb_threads = atoi(optarg);
+                break;
+	    case 'S' : stream_mode = true;
+                break;
+	    case 'T' : tiled_cache = atoi(optarg);
+                if (tiled_cache < TILED_MIN_CACHE) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'd' : batch_source = optarg;
+                batch_is_list = false;
+                break;
+	    case 'l' : batch_source = optarg;
+                batch_is_list = true;
+                break;
+	    case 'o' : dest_dir = optarg;
+                break;
+	    case 'n' : external = false;
+                break;
+	    case 'k' : kernel_to_use = kernel_find(optarg);
+                if (!kernel_to_use) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'K' : kernel_free(loaded_kernel);
+                kernel_to_use = loaded_kernel = kernel_load(optarg);
+                break;
+	    case 'b' : if (!conv_border_parse(optarg, &border_to_use)) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'r' : box_radius = atoi(optarg);
+                if (box_radius < 1 || box_radius > INTEGRAL_MAX_RADIUS) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'a' : if (!integral_threshold_parse(optarg, &threshold_radius,
+                                              &threshold_k)) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'm' : if (!morph_parse(optarg, &morph)) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                morph_to_use = &morph;
+                break;
+	    case 'g' : if (!gradient_parse(optarg, &grad)) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                gradient_to_use = &grad;
+                break;
+	    case 'c' : chain_spec = optarg;
+                break;
+	    case 'e' : if (!hist_parse(optarg, &hist)) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                hist_to_use = &hist;
+                break;
+	    case 'C' : color_filter = true;
+                break;
+	    case 'D' : if (!pyramid_size_parse(optarg, &preview_width,
+                                               &preview_height)) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'P' : pyramid_levels = atoi(optarg);
+                if (pyramid_levels < 1 ||
+                    pyramid_levels > PYRAMID_MAX_LEVELS) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+	    case 'w' : wide_output = true;
+                break;
+	    case 'j' : trace_open(optarg);
+		break;
+	    case 'V' : video_mode = true;
+                break;
+	    case 'B' : bench_mode = true;
+                break;
             default: print_usage();
                 exit(EXIT_FAILURE);
         }
     }
 
+    /* After the options, the chain may use the kernel of -K */
+    if (chain_spec) {
+        if (!chain_parse(chain_spec, &chain)) {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+        chain_to_use = &chain;
+    }
+    if (box_radius && threshold_radius) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    if (color_filter && (filter_x_y != conv_filter_x_y || box_radius ||
+                         threshold_radius || morph_to_use ||
+                         gradient_to_use || chain_to_use)) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    if (wide_output && (filter_x_y != conv_filter_x_y || box_radius ||
+                        threshold_radius ||
+                        morph_to_use || gradient_to_use || chain_to_use ||
+                        color_filter || pyramid_levels || tiled_cache ||
+                        video_mode || stream_mode || bench_mode ||
+                        batch_source || pnm_format(result_path) == PNM_NONE)) {
+        fprintf(stderr, "[%s] only the convolution of an image is written "
+                "in 16 bits, to a .pgm or .raw file\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    if (pyramid_levels && (batch_source || stream_mode || bench_mode ||
+                           chain_to_use || color_filter || preview_width)) {
+        fprintf(stderr, "[%s] the pyramids are built from one grayscale "
+                "image, not with -d, -l, -S, -B, -c, -C or -D\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Tile by tile from file to file, for the images larger than the
+     * memory. The sizes of the raw images may then be over 32 bits */
+    if (tiled_cache) {
+        if (filter_x_y != conv_filter_x_y ||
+            border_to_use.mode != BORDER_COPY || box_radius ||
+            threshold_radius ||
+            chain_to_use || morph_to_use || gradient_to_use ||
+            hist_to_use || color_filter || preview_width || pyramid_levels ||
+            video_mode || pnm_format(image_path) == PNM_NONE) {
+            fprintf(stderr, "[%s] only convolutions with the copy border "
+                    "of PGM and raw images are tiled\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        if (pnm_format(result_path) == PNM_NONE) {
+            fprintf(stderr, "[%s] the tiled result is written to a .pgm or "
+                    ".raw file (-O), not %s\n", __func__, result_path);
+            exit(EXIT_FAILURE);
+        }
+        thread_pool_init(nb_threads);
+        tiled_filter(image_path, result_path, raw_size, kernel_to_use,
+                     tiled_cache);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+    if (raw_size && !pnm_raw_parse(raw_size, &raw_input)) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    /* Frames from stdin to stdout, stdout is then only for the frames */
+    if (video_mode) {
+        if (stream_mode || bench_mode || batch_source || hist_to_use ||
+            color_filter || preview_width || pyramid_levels ||
+            (gradient_to_use && gradient_to_use->orientation)) {
+            fprintf(stderr, "[%s] the frames only go through the filter "
+                    "or the chain\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        thread_pool_init(nb_threads);
+        video_filter(raw_size ? &raw_input : NULL, filter_frame);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
+    /* Row by row from file to file, the image is never fully in memory */
+    if (stream_mode) {
+        stream_filter(image_path, result_path);
+        kernel_free(loaded_kernel);
+        return EXIT_SUCCESS;
+    }
+
+    /* Start the workers once for all the stages */
+    thread_pool_init(nb_threads);
+
+    /* Filter stages alone, no file written */
+    if (bench_mode) {
+        bench_filters();
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
+    /* Many images in this process, see batch_filter() */
+    if (batch_source) {
+        int different = batch_filter(batch_source, batch_is_list, dest_dir,
+                                     external, show_error);
+
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return different ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     /* Load image */
     img = load_image(image_path);
 
+    /* All the stages of the chain in one pass, nothing to compare with */
+    if (chain_to_use) {
+        if (hist_to_use) {
+            histogram_stage(img, hist_to_use);
+        }
+        img_result = chain_run(chain_to_use, img);
+        save_image(result_path, img_result);
+        free_container(img);
+        free_container(img_result);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
+    /* Each color plane through the convolution, nothing to compare with */
+    if (color_filter && img->comp != COMPONENT_GRAYSCALE) {
+        filter_color(img, result_path);
+        free_container(img);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
     /* Check if grayscale */
     if (img->comp != COMPONENT_GRAYSCALE) {
         img_grayscale = grayscale_conversion(img);
@@ -101,16 +439,90 @@ int main(int argc, char **argv)
         img_grayscale = img;
     }
 
+    /* Statistics and tone of the grayscale image, in place */
+    if (hist_to_use) {
+        histogram_stage(img_grayscale, hist_to_use);
+    }
+
+    /* Gaussian and Laplacian levels instead of the filter */
+    if (pyramid_levels) {
+        pyramid_gaussian(&gauss, img_grayscale, pyramid_levels);
+        pyramid_laplacian(&laplacian, &gauss);
+        save_pyramid(result_path, "gaussian", &gauss);
+        save_pyramid(result_path, "laplacian", &laplacian);
+        pyramid_free(&gauss);
+        pyramid_free(&laplacian);
+        if (img_grayscale != img) {
+            free_container(img_grayscale);
+        }
+        free_container(img);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
+    /* The filter runs on a smaller preview */
+    if (preview_width) {
+        img_preview = downscale(img_grayscale, preview_width,
+                                preview_height);
+        if (img_grayscale != img) {
+            free_container(img_grayscale);
+        }
+        img_grayscale = img_preview;
+    }
+
+    /* 16 bits result, nothing to compare with */
+    if (wide_output) {
+        filter_wide(img_grayscale, result_path);
+        if (img_grayscale != img) {
+            free_container(img_grayscale);
+        }
+        free_container(img);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
     /* Display original image */
     /*sprintf(cmd, "display %s &", image_path);*/
     /*system(cmd);*/
 
-    /* Do the filtering */
-    img_result = apply_filter(img_grayscale);
-    img_result_student = apply_filter_student(img_grayscale);
+    /* Do the filtering, the orientation comes with the magnitude */
+    if (gradient_to_use && gradient_to_use->orientation) {
+        img_result = gradient(img_grayscale, gradient_to_use, &img_dir);
+        save_orientation(result_path, img_dir);
+        free_container(img_dir);
+    } else if (student_filter_supported()) {
+        img_result = apply_filter_reference(img_grayscale);
+    } else {
+        img_result = apply_filter(img_grayscale);
+    }
+
+    /* Nothing to compare with */
+    if (!student_filter_supported()) {
+        printf("[%s] the student's filter only does 3x3 integer kernels "
+               "without factor, with the copy border, no box blur, no "
+               "threshold, no morphology and no gradient\n", __func__);
+        save_image(result_path, img_result);
+        if (img_grayscale != img) {
+            free_container(img_grayscale);
+        }
+        free_container(img);
+        free_container(img_result);
+        kernel_free(loaded_kernel);
+        thread_pool_destroy();
+        return EXIT_SUCCESS;
+    }
+
+    if (img->comp != COMPONENT_GRAYSCALE && fused_student_supported()) {
+        /* Grayscale conversion and filter in one pass on the color image */
+        img_result_student = apply_filter_student_fused(img);
+    } else {
+        img_result_student = apply_filter_student(img_grayscale);
+    }
 
     /* Save the results */
-    save_image(RESULT_FILE, img_result);
+    save_image(result_path, img_result);
     save_image(STUDENT_FILE, img_result_student);
 
     /* Show differences if any */
@@ -119,10 +531,11 @@ int main(int argc, char **argv)
                "---------------------------------------\n"
                "The result is different than expected !\n"
                "---------------------------------------\n");
-        sprintf(cmd, "compare %s %s %s", RESULT_FILE, STUDENT_FILE, DIFF_FILE);
-        system(cmd);
-        sprintf(cmd, "display %s &", DIFF_FILE);
-        system(cmd);
+        if (external) {
+            run_compare(result_path, STUDENT_FILE, DIFF_FILE);
+            sprintf(cmd, "display %s &", DIFF_FILE);
+            system(cmd);
+        }
     }
     else {
         printf("\n"
@@ -132,17 +545,22 @@ int main(int argc, char **argv)
     }
 
     /* Display student's result */
-    sprintf(cmd, "display %s &", STUDENT_FILE);
-    system(cmd);
+    if (external) {
+        sprintf(cmd, "display %s &", STUDENT_FILE);
+        system(cmd);
+    }
 
     /* Free the containers */
-    free_container(img);
-    if (img->comp != COMPONENT_GRAYSCALE) {
+    if (img_grayscale != img) {
       free_container(img_grayscale);
     }
+    free_container(img);
     free_container(img_result);
     free_container(img_result_student);
 
+    kernel_free(loaded_kernel);
+    thread_pool_destroy();
+
     /* Exit */
     return EXIT_SUCCESS;
 }
@@ -154,18 +572,194 @@ int main(int argc, char **argv)
 /* Prints the usage message */
 void print_usage()
 {
-  printf("Usage : image_processing [-f] filename [-s]\n");
+  printf("Usage : image_processing [-f] filename [-O result] [-R size] "
+         "[-z level] [-s] [-t threads] [-S | -T tiles]\n");
+  printf("        image_processing [-d dir | -l list] [-o dir] [-n]\n");
+  printf("        image_processing -V [-R size] < frames > filtered\n");
   printf("-f specify the image file to be processed\n");
+  printf("-O result file (default : %s), .pgm and .raw files are written "
+         "without encoding\n", RESULT_FILE);
+  printf("-z compression level of the PNG files : 0 (stored), 1 (fast) to 9 "
+         "(small), default %d\n", ZLIB_DEFAULT_LEVEL);
+  printf("-R size of the .raw images : widthxheight[xplanes], planes of 1 "
+         "(default), 3 or 4 components\n");
   printf("-s shows the differences between student's result and expected result in stdout\n");
+  printf("-t number of threads used by the filters (default : one per CPU)\n");
+  printf("-S streams the image row by row through the filter into %s\n",
+         RESULT_FILE);
+  printf("-T filters a PGM or raw image larger than the memory by tiles "
+         "of %dx%d,\n   keeping at most this number of tiles (at least "
+         "%d, eg %d)\n", TILE_SIZE, TILE_SIZE, TILED_MIN_CACHE,
+         TILED_DEFAULT_CACHE);
+  printf("-V filters the frames of a Y4M video (luma only) or raw "
+         "grayscale frames of the -R size\n   from stdin to stdout, eg "
+         "ffmpeg -i in.mp4 -f yuv4mpegpipe - | image_processing -V | ...\n");
+  printf("-d filters every image of a directory\n");
+  printf("-l filters every image listed in a file (one path per line)\n");
+  printf("-o directory of the batch results (default : .)\n");
+  printf("-n never runs external programs (compare, display)\n");
+  printf("-k convolution kernel :");
+  for (const named_kernel *k = named_kernels; k->name; ++k) {
+      printf(" %s%s", k->name, k->kernel == &KERNEL_TO_USE ? " (default)" : "");
+  }
+  printf("\n");
+  printf("-K reads the convolution kernel from a file : size, factor and "
+         "the coefficients (int8 or float)\n");
+  printf("-b border mode of the convolution : copy (default), clamp, "
+         "mirror, wrap or constant[:value]\n");
+  printf("-r box blur of any radius (1 to %d) with the integral image "
+         "instead of the convolution\n", INTEGRAL_MAX_RADIUS);
+  printf("-a adaptive threshold with the integral image instead of the "
+         "convolution : radius (1 to %d)[:k],\n   255 above the mean of the "
+         "window plus k (default 0) standard deviations\n",
+         INTEGRAL_MAX_RADIUS);
+  printf("-m morphology with a rectangle instead of the filter : "
+         "erode, dilate, open or close:size or :widthxheight (1 to %d)\n",
+         MORPH_MAX_SIZE);
+  printf("-g Sobel or Scharr gradient magnitude instead of the filter : "
+         "sobel or scharr,\n   then :l1 (default) or :l2, and :dir writes "
+         "the orientation as <result>_orientation\n");
+  printf("-c chain of filters run in one pass, eg sharpen,edge or "
+         "gray,median:2,box,threshold:64 : kernel names, kernel (-k/-K), "
+         "median[:radius] and threshold:value\n");
+  printf("-e statistics of the image before the filter : stats, equalize "
+         "or levels[:percent clipped at each end]\n");
+  printf("-C convolution of each color plane, the result stays in color "
+         "(planes as they are in .raw files)\n");
+  printf("-D filters a preview of widthxheight pixels instead of the image "
+         "(2x box steps then bilinear)\n");
+  printf("-P writes the Gaussian and Laplacian pyramids of the grayscale "
+         "image, up to %d levels,\n   as <result>_gaussian<level> and "
+         "<result>_laplacian<level>\n", PYRAMID_MAX_LEVELS);
+  printf("-w writes the convolution in 16 bits per pixel (8 bits after "
+         "the point) to a .pgm or .raw result\n");
+  printf("-B times the filters and prints the results as CSV (make bench)\n");
+  printf("-j writes the time, cycles, bytes and allocations of each stage "
+         "to a file,\n   a Chrome trace for .json files, else one JSON "
+         "object per line\n");
+}
+
+/* The student's filter only does 3x3 int8 kernels without factor and
+ * copies the border pixels, no box blur, threshold, morphology or
+ * gradient */
+bool student_filter_supported(void)
+{
+    return kernel_to_use->size == KERNEL_SIZE && kernel_to_use->factor == 1 &&
+           !kernel_to_use->fcoeffs && border_to_use.mode == BORDER_COPY &&
+           !box_radius && !threshold_radius && !morph_to_use &&
+           !gradient_to_use;
+}
+
+/* The fused student's filter starts from the color image, it is only
+ * used when the tone stage and the preview leave the grayscale image as
+ * it is */
+static bool fused_student_supported(void)
+{
+    return (!hist_to_use || hist_to_use->op == HIST_STATS) &&
+           !preview_width;
 }
 
-/* Allocates an image container and space for the image data */
+/* Writes <dest without extension>_<suffix><index>.<ext> in path (of
+ * PATH_SIZE), without index when it is negative */
+static void suffixed_path(char *path, const char *dest_img_path,
+                          const char *suffix, int index)
+{
+    const char *ext = strrchr(dest_img_path, '.');
+    char number[16] = "";
+    int name_len;
+
+    if (!ext || strchr(ext, '/')) {
+        ext = "";
+    }
+    name_len = ext - dest_img_path;
+    if (!*ext) {
+        name_len = strlen(dest_img_path);
+    }
+    if (index >= 0) {
+        snprintf(number, sizeof (number), "%d", index);
+    }
+    snprintf(path, PATH_SIZE, "%.*s_%s%s%s", name_len, dest_img_path,
+             suffix, number, ext);
+}
+
+/* Saves the orientations as <dest without extension>_orientation.<ext>,
+ * spread over the gray levels so they can be seen (0, 85, 170, 255) */
+static void save_orientation(const char *dest_img_path,
+                             image_container *dir)
+{
+    char path[PATH_SIZE];
+    uint8_t lut[HIST_BINS] = {
+        [GRADIENT_DIR_0] = 0, [GRADIENT_DIR_45] = 85,
+        [GRADIENT_DIR_90] = 170, [GRADIENT_DIR_135] = 255
+    };
+
+    histogram_apply_lut(dir, lut);
+    suffixed_path(path, dest_img_path, "orientation", -1);
+    save_image(path, dir);
+}
+
+/* Saves the levels as <dest without extension>_<suffix><level>.<ext> */
+static void save_pyramid(const char *dest_img_path, const char *suffix,
+                         const image_pyramid *pyr)
+{
+    char path[PATH_SIZE];
+    int l;
+
+    for (l = 0; l < pyr->nb_levels; ++l) {
+        suffixed_path(path, dest_img_path, suffix, l);
+        save_image(path, pyr->level[l]);
+    }
+}
+
+/* Splits a color image into planes, convolves them with the kernel and
+ * saves the result, see planar.h */
+static void filter_color(image_container *img, const char *dest_img_path)
+{
+    planar_image planes, filtered;
+
+    if (hist_to_use) {
+        histogram_stage(img, hist_to_use);
+    }
+    planar_split(&planes, img);
+    planar_convolve(&planes, &filtered, kernel_to_use, &border_to_use);
+    planar_save(dest_img_path, &filtered);
+    planar_free(&planes);
+    planar_free(&filtered);
+}
+
+/* The chain or the filter on each frame of -V */
+static image_container *filter_frame(image_container *frame)
+{
+    if (chain_to_use) {
+        return chain_run(chain_to_use, frame);
+    }
+    return apply_filter(frame);
+}
+
+/* Allocates an image container and space for the image data
+ * The rows are padded to ROW_ALIGNMENT and the data is not zeroed, it
+ * comes from the arena or from the buffer pool */
 image_container *allocate_container(size_t width, size_t height, size_t comp)
 {
     if (comp == 0 || comp > COMPONENT_RGBA)
         return NULL;
 
     image_container *img;
+    const size_t stride = (width * comp + ROW_ALIGNMENT - 1) &
+                          ~(size_t)(ROW_ALIGNMENT - 1);
+
+    if (container_arena) {
+        img = arena_alloc(container_arena, sizeof (image_container));
+        img->width = width;
+        img->height = height;
+        img->comp = comp;
+        img->stride = stride;
+        img->data = arena_alloc(container_arena, stride * height);
+        img->pooled = false;
+        img->map = NULL;
+        trace_alloc(stride * height);
+        return img;
+    }
 
     /* Allocate the struct */
     img = malloc(sizeof (image_container));
@@ -178,24 +772,54 @@ image_container *allocate_container(size_t width, size_t height, size_t comp)
     img->width = width;
     img->height = height;
     img->comp = comp;
+    img->stride = stride;
+    img->map = NULL;
 
-    /* Allocate space for image */
-    img->data = calloc(img->width * img->height * img->comp, sizeof (uint8_t));
-    if (!(img->data)) {
-        fprintf(stderr, "[%s] image allocation error\n", __func__);
-        perror(__func__);
-        exit(EXIT_FAILURE);
-    }
+    /* Allocate space for image, recycled from the previous stages */
+    img->data = buffer_pool_alloc(stride * height);
+    img->pooled = true;
+    trace_alloc(stride * height);
 
     return img;
 }
 
+/* Bytes of the pixels of img, without the padding of the rows */
+static uint64_t container_bytes(const image_container *img)
+{
+    return (uint64_t)img->width * img->height * img->comp;
+}
+
+/* Copies the pixels of src to dst, of the same size and components */
+void copy_container_rows(image_container *dst, const image_container *src)
+{
+    const size_t row_size = (size_t)src->width * src->comp;
+    int32_t y;
+
+    if (dst->stride == src->stride) {
+        memcpy(dst->data, src->data, (size_t)src->stride * src->height);
+        return;
+    }
+    for (y = 0; y < src->height; ++y) {
+        memcpy(image_row(dst, y), image_row(src, y), row_size);
+    }
+}
+
 /* Function that takes a path to an image file and loads
    the image in memory. */
 image_container *load_image(const char *src_img_path)
 {
     FILE *fimg;
     image_container *img;
+    trace_span span;
+
+    trace_begin(&span, __func__);
+
+    /* Mapped, nothing to decode */
+    if (pnm_format(src_img_path) != PNM_NONE) {
+        img = pnm_load(src_img_path, &raw_input);
+        trace_end(&span, container_bytes(img));
+        return img;
+    }
 
     /* Open the image file */
     fimg = fopen(src_img_path, "rb"); /* Read Binary */
@@ -211,22 +835,58 @@ image_container *load_image(const char *src_img_path)
         exit(EXIT_FAILURE);
     }
 
-    /* Load the image in the struct */
+    /* Load the image in the struct, stb gives rows without padding */
+    img->map = NULL;
+    img->pooled = false;
     img->data = stbi_load(src_img_path, &(img->width), &(img->height),
                           &(img->comp), 0);
     if (!(img->data)) {
         fprintf(stderr, "[%s] stb load image failed\n", __func__);
         exit(EXIT_FAILURE);
     }
+    img->stride = img->width * img->comp;
 
     fprintf(stdout, "[%s] image %s loaded (%d components, %dx%d)\n", __func__,
             src_img_path, img->comp, img->width, img->height);
+    trace_end(&span, container_bytes(img));
+    return img;
+}
+
+/* Same as load_image() but the rows are decoded into a container from
+ * allocate_container(), so the batch mode decodes into its arena */
+image_container *load_image_rows(const char *src_img_path)
+{
+    png_reader *reader;
+    image_container *img;
+    trace_span span;
+    int32_t y;
+
+    trace_begin(&span, __func__);
+
+    /* Mapped instead, outside of the arena */
+    if (pnm_format(src_img_path) != PNM_NONE) {
+        img = pnm_load(src_img_path, &raw_input);
+        trace_end(&span, container_bytes(img));
+        return img;
+    }
+
+    reader = png_reader_open(src_img_path);
+    img = allocate_container(reader->width, reader->height, reader->comp);
+
+    for (y = 0; y < img->height; ++y) {
+        png_reader_read_row(reader, image_row(img, y));
+    }
+    png_reader_close(reader);
+
+    trace_end(&span, container_bytes(img));
     return img;
 }
 
 /* Creates a grayscale version of the image */
 image_container *grayscale_conversion(image_container *img)
 {
+    trace_span span;
+
     if (img->comp != COMPONENT_RGB && img->comp != COMPONENT_RGBA) {
         fprintf(stderr, "[%s] only accepts color images with RGB components\n",
                 __func__);
@@ -234,178 +894,767 @@ image_container *grayscale_conversion(image_container *img)
         exit(EXIT_FAILURE);
     }
 
+    trace_begin(&span, __func__);
     image_container *grayscale = allocate_container(img->width,
 						    img->height,
 						    COMPONENT_GRAYSCALE);
 
-    size_t index = 0;
-    int i, j;
+    band_args args = { .src = img, .dst = grayscale };
 
-    for (i = 0; i < img->height; ++i) {
-        for (j = 0; j < img->width; ++j) {
+    thread_pool_run(grayscale_conversion_band, &args, img->height,
+                    thread_pool_band_rows(img->width * (img->comp + 1), 0));
+    trace_end(&span, container_bytes(img) + container_bytes(grayscale));
 
-            grayscale->data[i * img->width + j] =
-                LUMINOSITY_R * img->data[index + R_OFFSET] +
-                LUMINOSITY_G * img->data[index + G_OFFSET] +
-                LUMINOSITY_B * img->data[index + B_OFFSET];
+    return grayscale;
+}
 
-            index += img->comp;
-        }
-    }
+/* Grayscale conversion of the rows [y_start, y_end[ */
+static void grayscale_conversion_band(void *arg, int32_t y_start,
+                                      int32_t y_end)
+{
+    band_args *args = arg;
+    image_container *img = args->src;
+    image_container *grayscale = args->dst;
+    int i;
 
-    return grayscale;
+    for (i = y_start; i < y_end; ++i) {
+        grayscale_row(image_row(img, i), image_row(grayscale, i),
+                      img->width, img->comp);
+    }
 }
 
-/* 8bit Comparison function from pointers */
-int compare_uint8_t(const void * a, const void * b)
+/* Grayscale conversion of one row of RGB or RGBA pixels
+ * The weights are in fixed point so that no float is involved */
+void grayscale_row(const uint8_t *src, uint8_t *dst, int32_t width, int comp)
 {
-    /* This is just like an x86 cmp */
-    return (*(uint8_t*)a - *(uint8_t*)b);
+    size_t index = 0;
+    int j;
+
+    if (__builtin_cpu_supports("ssse3")) {
+        asm_grayscale_row_ssse3(src, dst, width, comp);
+        return;
+    }
+
+    for (j = 0; j < width; ++j) {
+
+        dst[j] =
+            (LUMINOSITY_R_Q7 * src[index + R_OFFSET] +
+             LUMINOSITY_G_Q7 * src[index + G_OFFSET] +
+             LUMINOSITY_B_Q7 * src[index + B_OFFSET]) >> LUMINOSITY_SHIFT;
+
+        index += comp;
+    }
 }
 
-static uint8_t _conv_filter_x_y(image_container *img, int8_t* kernel_3x3, int32_t x, int32_t y)
+static uint8_t _conv_filter_x_y(image_container *img,
+                                const conv_kernel *kernel,
+                                const conv_border *border,
+                                int32_t x, int32_t y)
 {
+    const int32_t radius = kernel->size / 2;
+
     /* If we are on the edges we keep the pixel as is */
-    if ((x - KERNEL_SIZE_3/2) < 0 ||
-        (y - KERNEL_SIZE_3/2) < 0 ||
-        (x + KERNEL_SIZE_3/2) >= img->width ||
-        (y + KERNEL_SIZE_3/2) >= img->height) {
-        return img->data[y * img->width + x];
+    if (border->mode == BORDER_COPY && ((x - radius) < 0 ||
+        (y - radius) < 0 ||
+        (x + radius) >= img->width ||
+        (y + radius) >= img->height)) {
+        return image_row(img, y)[x];
     }
     /* Else we apply the filter */
+    else if (kernel->fcoeffs) {
+        /* Fused from the top left pixel, as conv_row() */
+        float result = 0;
+        for (int j = radius; j >= -radius; --j) {
+            for (int i = radius; i >= -radius; --i) {
+                float pixel = border_pixel(img, x - i, y - j, border);
+                float coeff = kernel->fcoeffs[(radius + j) * kernel->size +
+                                              radius + i];
+                result = fmaf(pixel, coeff, result);
+            }
+        }
+
+        return conv_normalize_float(result, kernel->factor);
+    }
     else {
         int32_t result = 0;
-	for(int j = -(KERNEL_SIZE_3/2); j <= (KERNEL_SIZE_3/2); ++j) {
-	    for (int i = -(KERNEL_SIZE_3/2); i <= (KERNEL_SIZE_3/2); ++i) {
-	        int32_t pixel = img->data[(y - j) * img->width + (x - i)];
-		int32_t coeff = kernel_3x3[(KERNEL_SIZE/2 + j) * KERNEL_SIZE + (KERNEL_SIZE/2) + i];
+	for(int j = -radius; j <= radius; ++j) {
+	    for (int i = -radius; i <= radius; ++i) {
+	        int32_t pixel = border_pixel(img, x - i, y - j, border);
+		int32_t coeff = kernel->coeffs[(radius + j) * kernel->size + radius + i];
 		result += pixel * coeff;
 	    }
 	}
 
-        result = abs(result);
-	if (result > UCHAR_MAX) {
-            result = UCHAR_MAX;
-	}
-	return result;
+	return conv_normalize(result, kernel->factor);
     }
 }
 
 uint8_t conv_filter_x_y(image_container *img, int32_t x, int32_t y)
 {
-    _conv_filter_x_y(img, KERNEL_3X3_TO_USE, x, y);
+    return _conv_filter_x_y(img, kernel_to_use, &border_to_use, x, y);
 }
 
 /* Apply a median filter to pixels at position x,y */
 uint8_t median_filter_x_y(image_container *img, int32_t x, int32_t y)
 {
-    /* If we are on the edges we keep the pixel as is */
-    if ((x - KERNEL_SIZE/2) < 0 ||
-        (y - KERNEL_SIZE/2) < 0 ||
-        (x + KERNEL_SIZE/2) >= img->width ||
-        (y + KERNEL_SIZE/2) >= img->height) {
-        return img->data[y * img->width + x];
-    }
-    /* Else we apply the filter */
-    else {
-        uint8_t array[5];
+    return median_x_y(img, MEDIAN_SHAPE, MEDIAN_RADIUS, x, y);
+}
 
-        /* Get the pixel and direct neighbors */
-        /*
-         *         N
-         *        NPN
-         *         N
-         *
-         * P : Pixel
-         * N : Neighbor
-         */
+/* Apply a filter to a grayscale image */
+image_container *apply_filter(image_container *img)
+{
+    image_container *processed_img;
+    trace_span span;
 
-        /* P : [x,y] */
-        array[0] = img->data[y * img->width + x];
-        /* N : [x+1,y], [x-1,y], [x,y+1], [x,y-1] */
-        array[1] = img->data[y * img->width + x + 1];
-        array[2] = img->data[y * img->width + x - 1];
-        array[3] = img->data[(y + 1) * img->width + x];
-        array[4] = img->data[(y - 1) * img->width + x];
+    trace_begin(&span, __func__);
+    processed_img = _apply_filter(img, false);
+    trace_end(&span, processed_img ? 2 * container_bytes(img) : 0);
+    return processed_img;
+}
 
-        /* Sort them */
-        qsort (array, 5, sizeof(uint8_t), compare_uint8_t);
+/* Same as apply_filter() on the C rows only, for the expected result of
+ * the student's filter that runs the SIMD rows */
+image_container *apply_filter_reference(image_container *img)
+{
+    image_container *processed_img;
+    trace_span span;
 
-        /* Return the median (center value of the array) */
-        /* [--M--] */
-        return array[2];
-    }
+    trace_begin(&span, __func__);
+    processed_img = _apply_filter(img, true);
+    trace_end(&span, processed_img ? 2 * container_bytes(img) : 0);
+    return processed_img;
 }
 
-/* Apply a filter to a grayscale image */
-image_container *apply_filter(image_container *img)
+static image_container *_apply_filter(image_container *img, bool reference)
 {
     /* Only works for grayscale images */
     if (img->comp != COMPONENT_GRAYSCALE) {
         return NULL;
     }
 
+    /* Erosion, dilation, opening or closing instead of the filter */
+    if (morph_to_use) {
+        return morphology(img, morph_to_use);
+    }
+
+    /* Gradient magnitude instead of the filter */
+    if (gradient_to_use) {
+        return gradient(img, gradient_to_use, NULL);
+    }
+
     image_container *processed_img = allocate_container(img->width,
                                                         img->height,
                                                         img->comp);
+    conv_kernel kernel = *kernel_to_use;
+    band_args args = { .src = img, .dst = processed_img,
+                       .border = &border_to_use };
+    integral_image integral;
 
-    /* For each pixel apply the filter */
-    int32_t x, y;
-    for (y = 0; y < img->height; ++y) {
-        for (x = 0; x < img->width; ++x) {
+    kernel.reference = reference;
 
-            processed_img->data[y * img->width + x] =
-                filter_x_y(img, x, y);
+    /* Box blur or adaptive threshold of any radius from the integral
+     * image, the threshold also reads the table of the squares */
+    if (box_radius || threshold_radius) {
+        integral_build(&integral, img, threshold_radius != 0);
+        args.integral = &integral;
+        thread_pool_run(apply_filter_band, &args, img->height,
+                        thread_pool_band_rows(img->width *
+                                              (4 * sizeof (uint32_t) + 2), 0));
+        integral_free(&integral);
+        return processed_img;
+    }
 
-        }
+    /* Convolutions run by rows, rank-1 kernels in a horizontal and a
+     * vertical pass */
+    if (filter_x_y == conv_filter_x_y) {
+        kernel_separate(&kernel);
+        args.kernel = &kernel;
     }
 
+    /* Bands read halo rows above and below them in the source */
+    thread_pool_run(apply_filter_band, &args, img->height,
+                    thread_pool_band_rows(2 * img->width,
+                                          filter_x_y == median_filter_x_y ?
+                                          MEDIAN_RADIUS :
+                                          kernel_to_use->size / 2));
+
     return processed_img;
 }
 
-/* Wrapper function to call the student's assembly code */
-image_container *apply_filter_student(image_container *img)
+/* Convolution of the grayscale img into 16 bits pixels saved to
+ * dest_img_path, see conv_rows16() */
+static void filter_wide(image_container *img, const char *dest_img_path)
 {
-    image_container *student_filtered_image = allocate_container(img->width,
-                                                                 img->height,
-                                                                 COMPONENT_GRAYSCALE);
+    const size_t size = (size_t)img->width * img->height * sizeof (uint16_t);
+    band_args args = { .src = img, .kernel = kernel_to_use,
+                       .border = &border_to_use };
+    trace_span span;
+
+    trace_begin(&span, "filter_wide");
+    args.wide = malloc(size);
+    if (!args.wide) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    trace_alloc(size);
+
+    thread_pool_run(filter_wide_band, &args, img->height,
+                    thread_pool_band_rows(3 * img->width,
+                                          kernel_to_use->size / 2));
+    trace_end(&span, container_bytes(img) + size);
+
+    pnm_save16(dest_img_path, args.wide, img->width, img->height,
+               img->width);
+    free(args.wide);
+}
+
+static void filter_wide_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    band_args *args = arg;
+
+    conv_rows16(args->src, args->wide, args->src->width, args->kernel,
+                args->border, y_start, y_end);
+}
+
+/* Apply the filter to the rows [y_start, y_end[ */
+static void apply_filter_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    band_args *args = arg;
+    image_container *img = args->src;
+    image_container *processed_img = args->dst;
+
+    if (args->integral) {
+        if (threshold_radius) {
+            integral_threshold_rows(args->integral, img, processed_img,
+                                    threshold_radius, threshold_k,
+                                    y_start, y_end);
+            return;
+        }
+        integral_mean_rows(args->integral, processed_img, box_radius,
+                           y_start, y_end);
+        return;
+    }
+    if (args->kernel) {
+        conv_rows(img, processed_img, args->kernel, args->border,
+                  y_start, y_end);
+        return;
+    }
+    if (filter_x_y == median_filter_x_y) {
+        median_rows(img, processed_img, MEDIAN_SHAPE, MEDIAN_RADIUS,
+                    y_start, y_end);
+        return;
+    }
 
     /* For each pixel apply the filter */
     int32_t x, y;
-    for (y = 0; y < img->height; ++y) {
+    for (y = y_start; y < y_end; ++y) {
         for (x = 0; x < img->width; ++x) {
-            /* Call student's assembly code */
-            asm_filter(img->data, student_filtered_image->data,
-                       img->width, img->height,
-                       x, y);
+
+            image_row(processed_img, y)[x] = filter_x_y(img, x, y);
+
         }
     }
+}
+
+/* Wrapper function to call the student's assembly code */
+image_container *apply_filter_student(image_container *img)
+{
+    image_container *student_filtered_image;
+    band_args args = { .src = img };
+    trace_span span;
+
+    trace_begin(&span, __func__);
+    student_filtered_image = allocate_container(img->width, img->height,
+                                                COMPONENT_GRAYSCALE);
+    args.dst = student_filtered_image;
+
+    /* asm_filter_rows() is reentrant, the bands run on the pool
+     * (3x3 kernels only, the kernel factor is not applied) */
+    thread_pool_run(apply_filter_student_band, &args, img->height,
+                    thread_pool_band_rows(2 * img->width, KERNEL_SIZE / 2));
+    trace_end(&span, 2 * container_bytes(img));
 
     return student_filtered_image;
 }
 
+/* The edge rows and pixels are copied by asm_filter_rows() */
+static void apply_filter_student_band(void *arg, int32_t y_start,
+                                      int32_t y_end)
+{
+    band_args *args = arg;
+    image_container *img = args->src;
+    image_container *dst = args->dst;
+
+    asm_filter_rows(img->data, dst->data, img->width, img->height,
+                    img->stride, dst->stride, y_start, y_end,
+                    kernel_to_use->coeffs);
+}
+
+/* Grayscale conversion and student's filter of a color image in one pass,
+ * the grayscale image is never written to memory */
+image_container *apply_filter_student_fused(image_container *img)
+{
+    image_container *student_filtered_image;
+    band_args args = { .src = img };
+    trace_span span;
+
+    trace_begin(&span, __func__);
+    student_filtered_image = allocate_container(img->width, img->height,
+                                                COMPONENT_GRAYSCALE);
+    args.dst = student_filtered_image;
+
+    thread_pool_run(apply_filter_student_fused_band, &args, img->height,
+                    thread_pool_band_rows(img->width * (img->comp + 1),
+                                          KERNEL_SIZE / 2));
+    trace_end(&span, container_bytes(img) +
+                     container_bytes(student_filtered_image));
+
+    return student_filtered_image;
+}
+
+/* The grayscale rows of a band live in a ring of KERNEL_SIZE rows that
+ * stays in L1, the rows just above and below the band are converted by
+ * both neighbouring bands */
+static void apply_filter_student_fused_band(void *arg, int32_t y_start,
+                                            int32_t y_end)
+{
+    band_args *args = arg;
+    image_container *img = args->src;
+    image_container *dst = args->dst;
+    const int32_t width = img->width;
+    uint8_t *ring, *rows[KERNEL_SIZE];
+    int32_t y, j, next_row;
+
+    ring = malloc(KERNEL_SIZE * width);
+    if (!ring) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    next_row = y_start > KERNEL_SIZE / 2 ? y_start - KERNEL_SIZE / 2 : 0;
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *out = image_row(dst, y);
+
+        /* Convert the rows up to y + 1 */
+        for (; next_row <= y + KERNEL_SIZE / 2 && next_row < img->height;
+             ++next_row) {
+            grayscale_row(image_row(img, next_row),
+                          ring + (next_row % KERNEL_SIZE) * width,
+                          width, img->comp);
+        }
+
+        /* If we are on the edges we keep the row as is */
+        if (y < KERNEL_SIZE / 2 || y >= img->height - KERNEL_SIZE / 2) {
+            memcpy(out, ring + (y % KERNEL_SIZE) * width, width);
+            continue;
+        }
+
+        for (j = 0; j < KERNEL_SIZE; ++j) {
+            rows[j] = ring + ((y - KERNEL_SIZE / 2 + j) % KERNEL_SIZE) * width;
+        }
+        filter_row_student(rows[0], rows[1], rows[2], out, width,
+                           kernel_to_use->coeffs);
+    }
+
+    free(ring);
+}
+
+/* Row version of the student's filter, AVX2 when the CPU has it */
+static void filter_row_student(uint8_t *top, uint8_t *mid, uint8_t *bottom,
+                               uint8_t *dest, int32_t width, int8_t *kernel)
+{
+    if (__builtin_cpu_supports("avx2")) {
+        asm_filter_row_avx2(top, mid, bottom, dest, width, kernel);
+    } else {
+        asm_filter_row_sse2(top, mid, bottom, dest, width, kernel);
+    }
+}
+
+/* Streaming version of the grayscale conversion and apply_filter()
+ * Rows are decoded, converted and filtered one at a time and written to
+ * the destination as soon as they are done. Only the kernel size last
+ * rows are kept, so the memory used only depends on the width */
+void stream_filter(const char *src_img_path, const char *dest_img_path)
+{
+    const conv_kernel *kernel = kernel_to_use;
+    const int32_t n = kernel->size;
+    const int32_t radius = n / 2;
+    const uint8_t *rows[MAX_KERNEL_SIZE];
+    png_reader *reader;
+    png_writer *writer;
+    uint8_t *in_row, *ring, *out_row;
+    int32_t y, j, next_row = 0;
+
+    if (filter_x_y != conv_filter_x_y || border_to_use.mode != BORDER_COPY ||
+        box_radius || threshold_radius || chain_to_use || morph_to_use ||
+        gradient_to_use ||
+        hist_to_use || color_filter || preview_width) {
+        fprintf(stderr, "[%s] only convolution filters with the copy border "
+                "can be streamed, no chain\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    /* Mapped files are already read and written without a full copy */
+    if (pnm_format(src_img_path) != PNM_NONE ||
+        pnm_format(dest_img_path) != PNM_NONE) {
+        fprintf(stderr, "[%s] only PNG files are streamed\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    reader = png_reader_open(src_img_path);
+    if (reader->comp != COMPONENT_GRAYSCALE &&
+        reader->comp != COMPONENT_RGB && reader->comp != COMPONENT_RGBA) {
+        fprintf(stderr, "[%s] only accepts grayscale, RGB or RGBA images\n",
+                __func__);
+        exit(EXIT_FAILURE);
+    }
+    writer = png_writer_open(dest_img_path, reader->width, reader->height,
+                             COMPONENT_GRAYSCALE, png_level);
+
+    /* Ring of the last n grayscale rows, row y is in slot y % n */
+    in_row = malloc((size_t)reader->width * reader->comp);
+    ring = malloc((size_t)n * reader->width);
+    out_row = malloc(reader->width);
+    if (!in_row || !ring || !out_row) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    for (y = 0; y < reader->height; ++y) {
+        /* Read the rows up to y + radius */
+        for (; next_row < reader->height && next_row <= y + radius;
+             ++next_row) {
+            uint8_t *slot = ring + (size_t)(next_row % n) * reader->width;
+
+            if (reader->comp == COMPONENT_GRAYSCALE) {
+                png_reader_read_row(reader, slot);
+            } else {
+                png_reader_read_row(reader, in_row);
+                grayscale_row(in_row, slot, reader->width, reader->comp);
+            }
+        }
+
+        /* If we are on the edges we keep the row as is */
+        if (y < radius || y >= reader->height - radius) {
+            memcpy(out_row, ring + (size_t)(y % n) * reader->width,
+                   reader->width);
+        } else {
+            for (j = 0; j < n; ++j) {
+                rows[j] = ring + (size_t)((y - radius + j) % n) *
+                                 reader->width;
+            }
+            conv_row(rows, out_row, reader->width, kernel);
+        }
+
+        png_writer_write_row(writer, out_row);
+    }
+
+    fprintf(stdout, "[%s] %s streamed to %s (%dx%d)\n", __func__,
+            src_img_path, dest_img_path, reader->width, reader->height);
+
+    png_writer_close(writer);
+    png_reader_close(reader);
+    free(in_row);
+    free(ring);
+    free(out_row);
+}
+
+/* Filters every image of a directory, or listed in a file, in this process
+ * All the containers of an image come from a single arena that is reset
+ * between images, once it has grown to the largest image no more memory
+ * is allocated for them. The results are saved in dest_dir as
+ * <name>_result.png. With external, the student's result and the output
+ * of compare are also saved for the images that differ.
+ * Returns the number of images whose student's result is different */
+int batch_filter(const char *source, bool is_list, const char *dest_dir,
+                 bool external, bool show_error)
+{
+    buffer_arena arena;
+    char **paths;
+    int count, i, different = 0;
+
+    paths = list_images(source, is_list, &count);
+
+    arena_init(&arena, 0);
+    container_arena = &arena;
+
+    for (i = 0; i < count; ++i) {
+        arena_reset(&arena);
+        if (batch_filter_image(paths[i], dest_dir, external,
+                               show_error) == DIFFERENT) {
+            different++;
+        }
+        free(paths[i]);
+    }
+
+    container_arena = NULL;
+    arena_destroy(&arena);
+    free(paths);
+
+    fprintf(stdout, "[%s] %d images filtered, %d different than expected\n",
+            __func__, count, different);
+    return different;
+}
+
+/* Filters one image of the batch, the containers are not freed */
+static char batch_filter_image(const char *src_img_path, const char *dest_dir,
+                               bool external, bool show_error)
+{
+    image_container *img, *img_grayscale, *img_result, *img_result_student;
+    char result_path[PATH_SIZE], student_path[PATH_SIZE], diff_path[PATH_SIZE];
+    const char *name, *ext, *result_ext;
+    int name_len;
+    char flag;
+
+    /* <dest_dir>/<name without extension>_<suffix>.png, the results of
+     * PGM, PPM and raw images stay mapped files (the result is gray
+     * without -C) */
+    name = strrchr(src_img_path, '/');
+    name = name ? name + 1 : src_img_path;
+    ext = strrchr(name, '.');
+    name_len = ext ? (int)(ext - name) : (int)strlen(name);
+    switch (pnm_format(src_img_path)) {
+    case PNM_PNM:
+        result_ext = color_filter ? "ppm" : "pgm";
+        break;
+    case PNM_RAW:
+        result_ext = "raw";
+        break;
+    default:
+        result_ext = "png";
+    }
+    snprintf(result_path, PATH_SIZE, "%s/%.*s_result.%s", dest_dir,
+             name_len, name, result_ext);
+    snprintf(student_path, PATH_SIZE, "%s/%.*s_student.png", dest_dir,
+             name_len, name);
+    snprintf(diff_path, PATH_SIZE, "%s/%.*s_diff.png", dest_dir,
+             name_len, name);
+
+    img = load_image_rows(src_img_path);
+    if (chain_to_use && (img->comp == COMPONENT_GRAYSCALE ||
+                         img->comp == COMPONENT_RGB ||
+                         img->comp == COMPONENT_RGBA)) {
+        if (hist_to_use) {
+            histogram_stage(img, hist_to_use);
+        }
+        save_image(result_path, chain_run(chain_to_use, img));
+        free_container(img);
+        return SAME;
+    }
+    if (color_filter && (img->comp == COMPONENT_RGB ||
+                         img->comp == COMPONENT_RGBA)) {
+        filter_color(img, result_path);
+        free_container(img);
+        return SAME;
+    }
+    if (img->comp == COMPONENT_GRAYSCALE) {
+        img_grayscale = img;
+    } else if (img->comp == COMPONENT_RGB || img->comp == COMPONENT_RGBA) {
+        img_grayscale = grayscale_conversion(img);
+    } else {
+        fprintf(stderr, "[%s] %s skipped (%d components)\n", __func__,
+                src_img_path, img->comp);
+        free_container(img);
+        return SAME;
+    }
+    if (hist_to_use) {
+        histogram_stage(img_grayscale, hist_to_use);
+    }
+    if (preview_width) {
+        img_grayscale = downscale(img_grayscale, preview_width,
+                                  preview_height);
+    }
+
+    if (!student_filter_supported()) {
+        img_result = apply_filter(img_grayscale);
+        save_image(result_path, img_result);
+        free_container(img);
+        return SAME;
+    }
+    img_result = apply_filter_reference(img_grayscale);
+    if (img->comp != COMPONENT_GRAYSCALE && fused_student_supported()) {
+        img_result_student = apply_filter_student_fused(img);
+    } else {
+        img_result_student = apply_filter_student(img_grayscale);
+    }
+
+    save_image(result_path, img_result);
+
+    flag = show_differences(img_result, img_result_student, show_error);
+    if (flag == DIFFERENT) {
+        fprintf(stdout, "[%s] %s is different than expected\n", __func__,
+                src_img_path);
+        if (external) {
+            save_image(student_path, img_result_student);
+            run_compare(result_path, student_path, diff_path);
+        }
+    }
+
+    /* The other containers are in the arena, not a mapping */
+    free_container(img);
+    return flag;
+}
+
+/* Runs compare (ImageMagick) to write the differences of two images to
+ * diff_path. The paths are given as they are, without a shell.
+ * Returns false when compare could not run or failed */
+static bool run_compare(const char *path_a, const char *path_b,
+                        const char *diff_path)
+{
+    extern char **environ;
+    char *const argv[] = {
+        "compare", (char *)path_a, (char *)path_b, (char *)diff_path, NULL
+    };
+    pid_t pid;
+    int error, status;
+
+    error = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (error) {
+        fprintf(stderr, "[%s] cannot run compare (%s)\n", __func__,
+                strerror(error));
+        return false;
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        fprintf(stderr, "[%s] waitpid error\n", __func__);
+        perror(__func__);
+        return false;
+    }
+
+    /* compare exits with 1 when the images are different, 2 on errors */
+    if (!WIFEXITED(status) || WEXITSTATUS(status) > 1) {
+        fprintf(stderr, "[%s] compare failed on %s and %s\n", __func__,
+                path_a, path_b);
+        return false;
+    }
+    return true;
+}
+
+/* Returns the paths of the images of a directory, in name order, or the
+ * paths listed in a file. The array and the paths are to be freed */
+static char **list_images(const char *source, bool is_list, int *count)
+{
+    static const char *const extensions[] = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".pgm", ".ppm", ".pnm",
+        ".raw"
+    };
+    char **paths = NULL;
+    char line[PATH_SIZE];
+    int size = 0;
+    size_t e;
+
+    *count = 0;
+
+    if (is_list) {
+        FILE *list = fopen(source, "r");
+
+        if (!list) {
+            fprintf(stderr, "[%s] fopen error (%s)\n", __func__, source);
+            exit(EXIT_FAILURE);
+        }
+        while (fgets(line, PATH_SIZE, list)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0') {
+                continue;
+            }
+            if (*count == size) {
+                size = size ? 2 * size : 16;
+                paths = realloc(paths, size * sizeof (char *));
+            }
+            if (!paths || !(paths[*count] = strdup(line))) {
+                fprintf(stderr, "[%s] allocation error\n", __func__);
+                perror(__func__);
+                exit(EXIT_FAILURE);
+            }
+            (*count)++;
+        }
+        fclose(list);
+        return paths;
+    }
+
+    struct dirent **entries;
+    int nb_entries = scandir(source, &entries, NULL, alphasort);
+    int i;
+
+    if (nb_entries < 0) {
+        fprintf(stderr, "[%s] scandir error (%s)\n", __func__, source);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    paths = malloc((nb_entries + 1) * sizeof (char *));
+    if (!paths) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nb_entries; ++i) {
+        const char *ext = strrchr(entries[i]->d_name, '.');
+
+        for (e = 0; ext && e < sizeof (extensions) / sizeof (*extensions);
+             ++e) {
+            if (!strcasecmp(ext, extensions[e])) {
+                snprintf(line, PATH_SIZE, "%s/%s", source,
+                         entries[i]->d_name);
+                paths[*count] = strdup(line);
+                if (!paths[(*count)++]) {
+                    fprintf(stderr, "[%s] allocation error\n", __func__);
+                    perror(__func__);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return paths;
+}
+
 /* Save the processed image to disk */
 void save_image(const char *dest_img_path, const image_container *img)
 {
-    if (!stbi_write_png(dest_img_path,
-                        img->width,
-                        img->height,
-                        img->comp,
-                        img->data,
-                        PNG_STRIDE_IN_BYTES)) {
-        fprintf(stderr, "[%s] save image failed\n", __func__);
-        exit(EXIT_FAILURE);
+    trace_span span;
+
+    trace_begin(&span, __func__);
+
+    /* No encoding for PGM, PPM and raw files */
+    if (pnm_format(dest_img_path) != PNM_NONE) {
+        pnm_save(dest_img_path, img);
+    } else {
+        /* Compressed in parallel, see png_write_image() */
+        png_write_image(dest_img_path, img->data, img->width, img->height,
+                        img->comp, img->stride, png_level);
+
+        fprintf(stdout, "[%s] PNG file %s saved (%dx%d)\n", __func__,
+                dest_img_path, img->width, img->height);
     }
 
-    fprintf(stdout, "[%s] PNG file %s saved (%dx%d)\n", __func__, dest_img_path,
-            img->width, img->height);
+    trace_end(&span, container_bytes(img));
 }
 
 /* Release the memory used by img */
 void free_container(image_container *img)
 {
+    /* Containers of pnm_load() are never in the arena */
+    if (img && img->map) {
+        pnm_unmap(img);
+        free(img);
+        return;
+    }
+
+    /* Containers of the arena are released by arena_reset() */
+    if (container_arena) {
+        return;
+    }
+
     if (img) {
-        if (img->data) {
+        if (img->pooled) {
+            buffer_pool_free(img->data, (size_t)img->stride * img->height);
+        } else if (img->data) {
             stbi_image_free(img->data);
         }
         free(img);
@@ -416,6 +1665,18 @@ void free_container(image_container *img)
  * returns SAME if both images are the same
  * The list option prints the differences */
 char show_differences(image_container *imgA, image_container *imgB, bool list)
+{
+    trace_span span;
+    char flag;
+
+    trace_begin(&span, __func__);
+    flag = _show_differences(imgA, imgB, list);
+    trace_end(&span, container_bytes(imgA) + container_bytes(imgB));
+    return flag;
+}
+
+static char _show_differences(image_container *imgA,
+                              image_container *imgB, bool list)
 {
     if (imgA->height != imgB->height) {
         fprintf(stderr, "[%s] Images not the same height!\n", __func__);
@@ -433,10 +1694,11 @@ char show_differences(image_container *imgA, image_container *imgB, bool list)
 
     char flag = SAME;
     int x, y;
-    uint8_t *ptr_a = imgA->data;
-    uint8_t *ptr_b = imgB->data;
-    for (y = 0; y < imgA->width; ++y) {
-        for (x = 0; x < imgA->height; ++x) {
+    uint8_t *ptr_a, *ptr_b;
+    for (y = 0; y < imgA->height; ++y) {
+        ptr_a = image_row(imgA, y);
+        ptr_b = image_row(imgB, y);
+        for (x = 0; x < imgA->width * imgA->comp; ++x) {
             if (*ptr_a != *ptr_b) {
 	        if (list) {
 		    printf("[%d,%d] : expected %X != %X\n", x, y, *ptr_a, *ptr_b);
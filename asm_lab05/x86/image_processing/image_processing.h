@@ -9,9 +9,16 @@
 #ifndef __IMAGE_PROCESSING_H__
 #define __IMAGE_PROCESSING_H__
 
-/* PNG file format allows for padding between rows of data
- * We will not use padding (padding of 0 bytes) */
-#define PNG_STRIDE_IN_BYTES 0
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/* Rows of allocate_container() start on a cache line, so the rows can
+ * be read with aligned vector loads. The bytes between width * comp and
+ * the stride are padding, never read as pixels */
+#define ROW_ALIGNMENT 64
 
 #define COMPONENT_RGBA      4 /* RGB 3 colors + alpha */
 #define COMPONENT_RGB       3 /* RGB 3 colors */
@@ -22,6 +29,13 @@
 #define LUMINOSITY_G 0.72
 #define LUMINOSITY_B 0.07
 
+/* Same weights in Q7 fixed point, they add up to 128 so white stays 255
+ * gray = (R * LUMINOSITY_R_Q7 + G * ... + B * ...) >> LUMINOSITY_SHIFT */
+#define LUMINOSITY_SHIFT 7
+#define LUMINOSITY_R_Q7 27 /* 0.21 * 128 */
+#define LUMINOSITY_G_Q7 92 /* 0.72 * 128 */
+#define LUMINOSITY_B_Q7 9  /* 0.07 * 128 */
+
 /* Offsets
  * Images are coded as RGB or RGBA */
 #define R_OFFSET 0
@@ -32,6 +46,7 @@
 /* Global Constants */
 #define KERNEL_SIZE 3
 #define CMD_SIZE 100
+#define PATH_SIZE 4096
 
 /* File paths */
 #define IMAGE_FILE "cpu.png"
@@ -43,4 +58,75 @@
 #define SAME 0
 #define DIFFERENT 1
 
+#ifndef __ASSEMBLER__
+typedef struct {
+    int width;
+    int height;
+    int comp; /* Number of components per pixel, eg RGB => 3 */
+    int stride; /* Bytes from a row to the next, at least width * comp */
+
+    uint8_t *data;
+    bool pooled;     /* data comes from buffer_pool_alloc() */
+    void *map;       /* File mapping holding data, NULL : none (pnm.h) */
+    size_t map_size;
+} image_container;
+
+/* First byte of the row y */
+static inline uint8_t *image_row(const image_container *img, int32_t y)
+{
+    return img->data + (size_t)y * img->stride;
+}
+
+#include "kernels.h"
+
+/* Stages of image_processing.c */
+image_container *allocate_container(size_t width,
+                                    size_t height,
+                                    size_t comp);
+image_container *load_image(const char *src_img_path);
+void copy_container_rows(image_container *dst, const image_container *src);
+image_container *load_image_rows(const char *src_img_path);
+image_container *grayscale_conversion(image_container *img);
+void grayscale_row(const uint8_t *src, uint8_t *dst, int32_t width, int comp);
+image_container *apply_filter(image_container *img);
+image_container *apply_filter_reference(image_container *img);
+image_container *apply_filter_student(image_container *img);
+image_container *apply_filter_student_fused(image_container *img);
+bool student_filter_supported(void);
+void save_image(const char *dest_img_path, const image_container *img);
+void free_container(image_container *img);
+char show_differences(image_container *imgA,
+                      image_container *imgB,
+		      bool list);
+
+/* Convolution kernel of the filters */
+extern conv_kernel *kernel_to_use;
+
+/* External Assembly Function declaration
+ * The width is also the stride, the rows must not be padded */
+extern void asm_filter(uint8_t *src, uint8_t *dest,
+                       int32_t width, int32_t height,
+                       int32_t x, int32_t y);
+/* Same convolution on the rows [y_start, y_end[ with any 3x3 kernel.
+ * Reentrant, the rows of an image can be filtered by several threads.
+ * The strides are the bytes from a row to the next */
+extern void asm_filter_rows(uint8_t *src, uint8_t *dest,
+                            int32_t width, int32_t height,
+                            int32_t src_stride, int32_t dest_stride,
+                            int32_t y_start, int32_t y_end, int8_t *kernel);
+/* Whole-image SIMD convolution, picks SSE2 or AVX2 at runtime */
+extern void asm_filter_image(uint8_t *src, uint8_t *dest,
+                             int32_t width, int32_t height,
+                             int32_t src_stride, int32_t dest_stride,
+                             int8_t *kernel);
+extern void asm_filter_image_sse2(uint8_t *src, uint8_t *dest,
+                                  int32_t width, int32_t height,
+                                  int32_t src_stride, int32_t dest_stride,
+                                  int8_t *kernel);
+extern void asm_filter_image_avx2(uint8_t *src, uint8_t *dest,
+                                  int32_t width, int32_t height,
+                                  int32_t src_stride, int32_t dest_stride,
+                                  int8_t *kernel);
+#endif
+
 #endif /* __IMAGE_PROCESSING_H__ */
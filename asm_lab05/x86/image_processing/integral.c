@@ -0,0 +1,207 @@
+/*
+ * File      : integral.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "integral.h"
+
+void integral_build(integral_image *ii, const image_container *img,
+                    bool squares)
+{
+    const size_t size = (size_t)(img->width + 1) * (img->height + 1);
+    int32_t x, y;
+
+    ii->width = img->width;
+    ii->height = img->height;
+    ii->stride = img->width + 1;
+    ii->sum = malloc(size * sizeof (uint32_t));
+    ii->sum_sq = squares ? malloc(size * sizeof (uint32_t)) : NULL;
+    if (!ii->sum || (squares && !ii->sum_sq)) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    for (x = 0; x < ii->stride; ++x) {
+        ii->sum[x] = 0;
+        if (squares) {
+            ii->sum_sq[x] = 0;
+        }
+    }
+
+    /* Running sum of the row added to the row above */
+    for (y = 0; y < img->height; ++y) {
+        const uint8_t *row = image_row(img, y);
+        const uint32_t *above = ii->sum + (size_t)y * ii->stride;
+        uint32_t *sum = ii->sum + (size_t)(y + 1) * ii->stride;
+        uint32_t row_sum = 0;
+
+        sum[0] = 0;
+        for (x = 0; x < img->width; ++x) {
+            row_sum += row[x];
+            sum[x + 1] = above[x + 1] + row_sum;
+        }
+
+        if (squares) {
+            const uint32_t *above_sq = ii->sum_sq + (size_t)y * ii->stride;
+            uint32_t *sum_sq = ii->sum_sq + (size_t)(y + 1) * ii->stride;
+            uint32_t row_sum_sq = 0;
+
+            sum_sq[0] = 0;
+            for (x = 0; x < img->width; ++x) {
+                row_sum_sq += (uint32_t)row[x] * row[x];
+                sum_sq[x + 1] = above_sq[x + 1] + row_sum_sq;
+            }
+        }
+    }
+}
+
+void integral_free(integral_image *ii)
+{
+    free(ii->sum);
+    free(ii->sum_sq);
+    ii->sum = NULL;
+    ii->sum_sq = NULL;
+}
+
+/* Rows [y0, y1[ of the window of the row y, clipped to the image */
+static void window_rows(const integral_image *ii, int32_t y, int32_t radius,
+                        int32_t *y0, int32_t *y1)
+{
+    if (radius < 0 || radius > INTEGRAL_MAX_RADIUS) {
+        fprintf(stderr, "[%s] radius must be between 0 and %d\n", __func__,
+                INTEGRAL_MAX_RADIUS);
+        exit(EXIT_FAILURE);
+    }
+    *y0 = y > radius ? y - radius : 0;
+    *y1 = y + radius + 1 < ii->height ? y + radius + 1 : ii->height;
+}
+
+/* Columns [x0, x1[ of the window of the column x, clipped to the image */
+static inline void window_columns(const integral_image *ii, int32_t x,
+                                  int32_t radius, int32_t *x0, int32_t *x1)
+{
+    *x0 = x > radius ? x - radius : 0;
+    *x1 = x + radius + 1 < ii->width ? x + radius + 1 : ii->width;
+}
+
+/* Sum of the window [x0, x1[ x [y0, y1[ given by its top and bottom rows
+ * of the table, exact modulo 2^32 */
+static inline uint32_t window_sum(const uint32_t *top, const uint32_t *bottom,
+                                  int32_t x0, int32_t x1)
+{
+    return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+void integral_mean_rows(const integral_image *ii, image_container *dst,
+                        int32_t radius, int32_t y_start, int32_t y_end)
+{
+    int32_t x, y, x0, x1, y0, y1;
+
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *out = image_row(dst, y);
+        const uint32_t *top, *bottom;
+
+        window_rows(ii, y, radius, &y0, &y1);
+        top = ii->sum + (size_t)y0 * ii->stride;
+        bottom = ii->sum + (size_t)y1 * ii->stride;
+
+        for (x = 0; x < ii->width; ++x) {
+            window_columns(ii, x, radius, &x0, &x1);
+            out[x] = window_sum(top, bottom, x0, x1) /
+                     (uint32_t)((y1 - y0) * (x1 - x0));
+        }
+    }
+}
+
+void integral_stats_row(const integral_image *ii, int32_t y, int32_t radius,
+                        float *mean, float *variance)
+{
+    const uint32_t *top, *bottom, *top_sq, *bottom_sq;
+    int32_t x, x0, x1, y0, y1;
+
+    if (!ii->sum_sq) {
+        fprintf(stderr, "[%s] the table of the squares was not built\n",
+                __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    window_rows(ii, y, radius, &y0, &y1);
+    top = ii->sum + (size_t)y0 * ii->stride;
+    bottom = ii->sum + (size_t)y1 * ii->stride;
+    top_sq = ii->sum_sq + (size_t)y0 * ii->stride;
+    bottom_sq = ii->sum_sq + (size_t)y1 * ii->stride;
+
+    for (x = 0; x < ii->width; ++x) {
+        uint64_t count, sum, sum_sq;
+
+        window_columns(ii, x, radius, &x0, &x1);
+        count = (uint64_t)(y1 - y0) * (x1 - x0);
+        sum = window_sum(top, bottom, x0, x1);
+        sum_sq = window_sum(top_sq, bottom_sq, x0, x1);
+
+        /* (n * sum(p^2) - sum(p)^2) / n^2 is exact in 64 bits */
+        mean[x] = (float)sum / count;
+        variance[x] = (float)(count * sum_sq - sum * sum) /
+                      (float)(count * count);
+    }
+}
+
+void integral_threshold_rows(const integral_image *ii,
+                             const image_container *img,
+                             image_container *dst, int32_t radius, float k,
+                             int32_t y_start, int32_t y_end)
+{
+    float *mean = malloc(2 * sizeof (float) * ii->width);
+    float *variance = mean + ii->width;
+    int32_t x, y;
+
+    if (!mean) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *src = image_row(img, y);
+        uint8_t *out = image_row(dst, y);
+
+        integral_stats_row(ii, y, radius, mean, variance);
+        for (x = 0; x < ii->width; ++x) {
+            out[x] = src[x] > mean[x] + k * sqrtf(variance[x]) ?
+                     UINT8_MAX : 0;
+        }
+    }
+    free(mean);
+}
+
+bool integral_threshold_parse(const char *arg, int32_t *radius, float *k)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if (end == arg || value < 1 || value > INTEGRAL_MAX_RADIUS) {
+        return false;
+    }
+    *radius = value;
+    *k = 0;
+    if (*end == ':') {
+        const char *number = end + 1;
+
+        *k = strtof(number, &end);
+        if (end == number || !isfinite(*k)) {
+            return false;
+        }
+    }
+    return !*end;
+}
@@ -0,0 +1,63 @@
+/*
+ * File      : integral.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Integral image (summed-area table) of a grayscale image. Once built,
+ * the sum, mean and variance of any window take four reads whatever its
+ * radius. Windows are clipped to the image, the pixels outside are not
+ * counted.
+ */
+
+#ifndef __INTEGRAL_H__
+#define __INTEGRAL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+
+/* The sums are kept modulo 2^32, the difference of four of them is still
+ * exact as long as the sum of the window fits in 32 bits : up to
+ * (2 x 127 + 1)^2 pixels for the squares */
+#define INTEGRAL_MAX_RADIUS 127
+
+typedef struct {
+    int32_t width;
+    int32_t height;
+    int32_t stride;    /* width + 1 */
+    /* sum[y * stride + x] : sum of the pixels above and left of x,y,
+     * the first row and column are zeros */
+    uint32_t *sum;
+    uint32_t *sum_sq;  /* Same with the squares, NULL when not built */
+} integral_image;
+
+/* Builds the table of img in one pass, and the table of the squares for
+ * the variance when squares is set. Exits on allocation error */
+void integral_build(integral_image *ii, const image_container *img,
+                    bool squares);
+void integral_free(integral_image *ii);
+
+/* Box blur : mean of the window of each pixel of the rows
+ * [y_start, y_end[ into dst, truncated like conv_normalize() */
+void integral_mean_rows(const integral_image *ii, image_container *dst,
+                        int32_t radius, int32_t y_start, int32_t y_end);
+
+/* Mean and variance of the window of each pixel of the row y, needs the
+ * table of the squares */
+void integral_stats_row(const integral_image *ii, int32_t y, int32_t radius,
+                        float *mean, float *variance);
+
+/* Adaptive threshold (Niblack) of the rows [y_start, y_end[ of img into
+ * dst : 255 where the pixel is above the mean of its window plus k
+ * standard deviations, 0 elsewhere. Needs the table of the squares */
+void integral_threshold_rows(const integral_image *ii,
+                             const image_container *img,
+                             image_container *dst, int32_t radius, float k,
+                             int32_t y_start, int32_t y_end);
+
+/* Reads radius[:k] of the adaptive threshold, k is 0 when not given.
+ * Returns false when the radius is not in [1, INTEGRAL_MAX_RADIUS] */
+bool integral_threshold_parse(const char *arg, int32_t *radius, float *k);
+
+#endif /* __INTEGRAL_H__ */
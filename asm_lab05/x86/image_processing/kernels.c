@@ -1,5 +1,9 @@
-#include <stdint.h>
-#define KERNEL_SIZE_3 3
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
 
 int8_t ridge_detection_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3] =
   { 0,-1, 0,
@@ -25,3 +29,139 @@ int8_t gaussian_blur_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3] =
   { 1, 2, 1,
     2, 4, 2,
     1, 2, 1};
+
+conv_kernel ridge_detection =
+  { KERNEL_SIZE_3, ridge_detection_3x3, 1 };
+
+conv_kernel edge_detection =
+  { KERNEL_SIZE_3, edge_detection_3x3, 1 };
+
+conv_kernel sharpen =
+  { KERNEL_SIZE_3, sharpen_3x3, 1 };
+
+/* The blurs are given with their row and column vectors */
+conv_kernel box_blur =
+  { KERNEL_SIZE_3, box_blur_3x3, BOX_BLUR_FACTOR,
+    true, { 1, 1, 1}, { 1, 1, 1} };
+
+conv_kernel gaussian_blur =
+  { KERNEL_SIZE_3, gaussian_blur_3x3, GAUSSIAN_BLUR_FACTOR,
+    true, { 1, 2, 1}, { 1, 2, 1} };
+
+int8_t gaussian_blur_5x5[KERNEL_SIZE_5 * KERNEL_SIZE_5] =
+  { 1,  4,  6,  4,  1,
+    4, 16, 24, 16,  4,
+    6, 24, 36, 24,  6,
+    4, 16, 24, 16,  4,
+    1,  4,  6,  4,  1};
+
+int8_t box_blur_7x7[KERNEL_SIZE_7 * KERNEL_SIZE_7] =
+  { 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1};
+
+conv_kernel gaussian_blur_5 =
+  { KERNEL_SIZE_5, gaussian_blur_5x5, GAUSSIAN_BLUR_5X5_FACTOR,
+    true, { 1, 4, 6, 4, 1}, { 1, 4, 6, 4, 1} };
+
+conv_kernel box_blur_7 =
+  { KERNEL_SIZE_7, box_blur_7x7, BOX_BLUR_7X7_FACTOR,
+    true, { 1, 1, 1, 1, 1, 1, 1}, { 1, 1, 1, 1, 1, 1, 1} };
+
+const named_kernel named_kernels[] = {
+    { "ridge",     &ridge_detection },
+    { "edge",      &edge_detection },
+    { "sharpen",   &sharpen },
+    { "box",       &box_blur },
+    { "gaussian",  &gaussian_blur },
+    { "gaussian5", &gaussian_blur_5 },
+    { "box7",      &box_blur_7 },
+    { NULL,        NULL }
+};
+
+conv_kernel *kernel_find(const char *name)
+{
+    const named_kernel *k;
+
+    for (k = named_kernels; k->name; ++k) {
+        if (!strcmp(k->name, name)) {
+            return k->kernel;
+        }
+    }
+    return NULL;
+}
+
+conv_kernel *kernel_load(const char *path)
+{
+    conv_kernel *kernel;
+    FILE *file;
+    int32_t size, factor, i;
+    bool integer = true;
+
+    file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "[%s] fopen error (%s)\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+    if (fscanf(file, "%d %d", &size, &factor) != 2 ||
+        size < 1 || size > MAX_KERNEL_SIZE || !(size & 1) || factor == 0) {
+        fprintf(stderr, "[%s] %s : expected an odd size up to %d and a "
+                "non zero factor\n", __func__, path, MAX_KERNEL_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    kernel = calloc(1, sizeof (conv_kernel));
+    if (kernel) {
+        kernel->coeffs = calloc(size * size, sizeof (int8_t));
+        kernel->fcoeffs = calloc(size * size, sizeof (float));
+    }
+    if (!kernel || !kernel->coeffs || !kernel->fcoeffs) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    kernel->size = size;
+    kernel->factor = factor;
+
+    for (i = 0; i < size * size; ++i) {
+        if (fscanf(file, "%f", &kernel->fcoeffs[i]) != 1) {
+            fprintf(stderr, "[%s] %s : %d coefficients expected\n", __func__,
+                    path, size * size);
+            exit(EXIT_FAILURE);
+        }
+        if (!isfinite(kernel->fcoeffs[i])) {
+            fprintf(stderr, "[%s] %s : coefficient %d is not a finite "
+                    "number\n", __func__, path, i + 1);
+            exit(EXIT_FAILURE);
+        }
+        /* Only cast once the value is known to fit in an int8 */
+        if (kernel->fcoeffs[i] < INT8_MIN || kernel->fcoeffs[i] > INT8_MAX ||
+            kernel->fcoeffs[i] != (int32_t)kernel->fcoeffs[i]) {
+            integer = false;
+        } else {
+            kernel->coeffs[i] = kernel->fcoeffs[i];
+        }
+    }
+    fclose(file);
+
+    /* Integer kernels take the int8 code paths */
+    if (integer) {
+        free(kernel->fcoeffs);
+        kernel->fcoeffs = NULL;
+    }
+
+    return kernel;
+}
+
+void kernel_free(conv_kernel *kernel)
+{
+    if (kernel) {
+        free(kernel->coeffs);
+        free(kernel->fcoeffs);
+        free(kernel);
+    }
+}
@@ -1,15 +1,68 @@
 #ifndef __KERNELS_H__
 #define __KERNELS_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define KERNEL_SIZE_3 3
+#define KERNEL_SIZE_5 5
+#define KERNEL_SIZE_7 7
+#define MAX_KERNEL_SIZE 15
+
 extern int8_t ridge_detection_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
 extern int8_t edge_detection_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
 extern int8_t sharpen_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
 #define BOX_BLUR_FACTOR 9
-extern int8_t *box_blur_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
+extern int8_t box_blur_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
 #define GAUSSIAN_BLUR_FACTOR 16
-extern int8_t *gaussian_blur_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
+extern int8_t gaussian_blur_3x3[KERNEL_SIZE_3 * KERNEL_SIZE_3];
+#define GAUSSIAN_BLUR_5X5_FACTOR 256
+extern int8_t gaussian_blur_5x5[KERNEL_SIZE_5 * KERNEL_SIZE_5];
+#define BOX_BLUR_7X7_FACTOR 49
+extern int8_t box_blur_7x7[KERNEL_SIZE_7 * KERNEL_SIZE_7];
+
+/* Convolution kernel
+ * The result of the convolution is divided by factor (1 : no division)
+ * When separable is set, coeffs[j * size + i] == col[j] * row[i]
+ * When fcoeffs is set the kernel is a float one and coeffs is not used
+ * When reference is set the convolution only runs on C rows, for the
+ * expected result of the student's filter */
+typedef struct {
+    int32_t size;     /* Odd, size x size coefficients */
+    int8_t *coeffs;   /* Row major */
+    int32_t factor;
+
+    bool separable;
+    int8_t row[MAX_KERNEL_SIZE];
+    int8_t col[MAX_KERNEL_SIZE];
+
+    float *fcoeffs;   /* Row major */
+
+    bool reference;
+} conv_kernel;
+
+extern conv_kernel ridge_detection;
+extern conv_kernel edge_detection;
+extern conv_kernel sharpen;
+extern conv_kernel box_blur;
+extern conv_kernel gaussian_blur;
+extern conv_kernel gaussian_blur_5;
+extern conv_kernel box_blur_7;
+
+/* Kernels that can be chosen at runtime */
+typedef struct {
+    const char *name;
+    conv_kernel *kernel;
+} named_kernel;
+
+extern const named_kernel named_kernels[];
+
+/* Returns the kernel called name, NULL if there is none */
+conv_kernel *kernel_find(const char *name);
+/* Reads a kernel from a text file : size, factor and the size x size
+ * coefficients. It is a float kernel unless all the coefficients are
+ * int8 integers. Exits on error */
+conv_kernel *kernel_load(const char *path);
+void kernel_free(conv_kernel *kernel);
 
 #endif /* __KERNELS_H__ */
@@ -0,0 +1,307 @@
+/*
+ * File      : median.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "median.h"
+
+#define HIST_BINS   256
+#define COARSE_BINS 16  /* Bins of the coarse histogram, 16 levels each */
+#define COARSE_SHIFT 4
+
+/* Row medians with sorting networks, see asm_median.S */
+extern void asm_median_cross_row_sse2(const uint8_t *top, const uint8_t *mid,
+                                      const uint8_t *bottom, uint8_t *dest,
+                                      int32_t width);
+extern void asm_median3x3_row_sse2(const uint8_t *top, const uint8_t *mid,
+                                   const uint8_t *bottom, uint8_t *dest,
+                                   int32_t width);
+
+/* Compare exchange, a gets the minimum */
+#define SORT(a, b) do {         \
+    if ((a) > (b)) {            \
+        uint8_t tmp = (a);      \
+        (a) = (b);              \
+        (b) = tmp;              \
+    }                           \
+} while (0)
+
+uint8_t median_x_y(const image_container *img, int shape, int32_t radius,
+                   int32_t x, int32_t y)
+{
+    const uint8_t *p = image_row(img, y) + x;
+
+    /* If we are on the edges we keep the pixel as is */
+    if ((x - radius) < 0 ||
+        (y - radius) < 0 ||
+        (x + radius) >= img->width ||
+        (y + radius) >= img->height) {
+        return *p;
+    }
+
+    if (shape == MEDIAN_CROSS) {
+        /* Median of 5 network */
+        uint8_t v[5] = {
+            p[-img->stride], p[-1], p[0], p[1], p[img->stride]
+        };
+
+        SORT(v[0], v[1]); SORT(v[3], v[4]); SORT(v[0], v[3]);
+        SORT(v[1], v[4]); SORT(v[1], v[2]); SORT(v[2], v[3]);
+        SORT(v[1], v[2]);
+        return v[2];
+    }
+
+    /* Counting selection over the window */
+    uint16_t hist[HIST_BINS] = { 0 };
+    int32_t i, j, sum = 0;
+    const int32_t rank = (2 * radius + 1) * (2 * radius + 1) / 2;
+
+    for (j = -radius; j <= radius; ++j) {
+        for (i = -radius; i <= radius; ++i) {
+            hist[p[j * img->stride + i]]++;
+        }
+    }
+    for (i = 0; sum + hist[i] <= rank; ++i) {
+        sum += hist[i];
+    }
+    return i;
+}
+
+/* Adds (sign 1) or removes (sign -1) a row to the column histograms */
+static void update_columns(uint16_t *fine, uint16_t *coarse,
+                           const uint8_t *row, int32_t width, int sign)
+{
+    int32_t x;
+
+    for (x = 0; x < width; ++x) {
+        fine[x * HIST_BINS + row[x]] += sign;
+        coarse[x * COARSE_BINS + (row[x] >> COARSE_SHIFT)] += sign;
+    }
+}
+
+/* Sliding histogram median (Perreault and Hebert, constant time)
+ * Each column keeps the histogram of its 2 x radius + 1 pixels of the
+ * window, updated by one pixel in and one out per row. Along a row the
+ * window histogram is the sum of the column histograms, updated by one
+ * column in and one out per pixel. Only the 16 bins coarse histogram is
+ * updated for every pixel, the fine bins are brought up to date for the
+ * coarse bin that holds the median only */
+static void median_histogram_rows(const image_container *src,
+                                  image_container *dst, int32_t radius,
+                                  int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    const int32_t n = 2 * radius + 1;
+    const int32_t rank = n * n / 2;
+    uint16_t window_coarse[COARSE_BINS];
+    uint16_t window_fine[COARSE_BINS][COARSE_BINS];
+    int32_t fine_x[COARSE_BINS];   /* Position of window_fine[k], -1 none */
+    uint16_t *fine, *coarse;
+    int32_t x, y, c, k, i, sum;
+
+    fine = calloc((size_t)width * HIST_BINS, sizeof (uint16_t));
+    coarse = calloc((size_t)width * COARSE_BINS, sizeof (uint16_t));
+    if (!fine || !coarse) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Rows y_start - radius to y_start + radius - 1, the loop adds the
+     * last row of the window */
+    for (y = y_start - radius; y < y_start + radius; ++y) {
+        update_columns(fine, coarse, image_row(src, y), width, 1);
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *in = image_row(src, y);
+        uint8_t *out = image_row(dst, y);
+
+        if (y > y_start) {
+            update_columns(fine, coarse, image_row(src, y - radius - 1),
+                           width, -1);
+        }
+        update_columns(fine, coarse, image_row(src, y + radius), width, 1);
+
+        /* If we are on the edges we keep the pixel as is */
+        memcpy(out, in, radius);
+        memcpy(out + width - radius, in + width - radius, radius);
+
+        memset(window_coarse, 0, sizeof (window_coarse));
+        for (c = 0; c < n; ++c) {
+            for (k = 0; k < COARSE_BINS; ++k) {
+                window_coarse[k] += coarse[c * COARSE_BINS + k];
+            }
+        }
+        for (k = 0; k < COARSE_BINS; ++k) {
+            fine_x[k] = -1;
+        }
+
+        for (x = radius; x < width - radius; ++x) {
+            if (x > radius) {
+                const uint16_t *add = coarse + (x + radius) * COARSE_BINS;
+                const uint16_t *sub = coarse + (x - radius - 1) * COARSE_BINS;
+
+                for (k = 0; k < COARSE_BINS; ++k) {
+                    window_coarse[k] += add[k] - sub[k];
+                }
+            }
+
+            /* Coarse bin holding the median */
+            sum = 0;
+            for (k = 0; sum + window_coarse[k] <= rank; ++k) {
+                sum += window_coarse[k];
+            }
+
+            /* Its fine bins, slid from their last position when it is
+             * cheaper than adding the n columns again */
+            uint16_t *bins = window_fine[k];
+            if (fine_x[k] < 0 || 2 * (x - fine_x[k]) > n) {
+                memset(bins, 0, COARSE_BINS * sizeof (uint16_t));
+                for (c = x - radius; c <= x + radius; ++c) {
+                    const uint16_t *col = fine + c * HIST_BINS +
+                                          k * COARSE_BINS;
+
+                    for (i = 0; i < COARSE_BINS; ++i) {
+                        bins[i] += col[i];
+                    }
+                }
+            } else {
+                for (c = fine_x[k] + 1; c <= x; ++c) {
+                    const uint16_t *add = fine + (c + radius) * HIST_BINS +
+                                          k * COARSE_BINS;
+                    const uint16_t *sub = fine + (c - radius - 1) *
+                                          HIST_BINS + k * COARSE_BINS;
+
+                    for (i = 0; i < COARSE_BINS; ++i) {
+                        bins[i] += add[i] - sub[i];
+                    }
+                }
+            }
+            fine_x[k] = x;
+
+            for (i = 0; sum + bins[i] <= rank; ++i) {
+                sum += bins[i];
+            }
+            out[x] = (k << COARSE_SHIFT) + i;
+        }
+    }
+
+    free(fine);
+    free(coarse);
+}
+
+void median_row(const uint8_t *const *rows, uint8_t *dst, int32_t width,
+                int shape, int32_t radius)
+{
+    const int32_t n = 2 * radius + 1;
+    const int32_t rank = n * n / 2;
+    uint16_t hist[HIST_BINS] = { 0 };
+    int32_t x, j, median = 0, below = 0;
+
+    if (width < n) {
+        memcpy(dst, rows[radius], width);
+        return;
+    }
+    if (shape == MEDIAN_CROSS) {
+        asm_median_cross_row_sse2(rows[0], rows[1], rows[2], dst, width);
+        return;
+    }
+    if (radius == 1) {
+        asm_median3x3_row_sse2(rows[0], rows[1], rows[2], dst, width);
+        return;
+    }
+
+    memcpy(dst, rows[radius], radius);
+    memcpy(dst + width - radius, rows[radius] + width - radius, radius);
+
+    for (j = 0; j < n; ++j) {
+        for (x = 0; x < n; ++x) {
+            hist[rows[j][x]]++;
+        }
+    }
+
+    /* below : number of pixels of the window under median */
+    for (x = radius; x < width - radius; ++x) {
+        if (x > radius) {
+            for (j = 0; j < n; ++j) {
+                uint8_t out = rows[j][x - radius - 1];
+                uint8_t in = rows[j][x + radius];
+
+                hist[out]--;
+                below -= out < median;
+                hist[in]++;
+                below += in < median;
+            }
+        }
+
+        while (below + hist[median] <= rank) {
+            below += hist[median++];
+        }
+        while (below > rank) {
+            below -= hist[--median];
+        }
+        dst[x] = median;
+    }
+}
+
+void median_rows(const image_container *src, image_container *dst,
+                 int shape, int32_t radius, int32_t y_start, int32_t y_end)
+{
+    const int32_t width = src->width;
+    int32_t y;
+
+    if (radius < 1 || radius > MEDIAN_MAX_RADIUS ||
+        (shape == MEDIAN_CROSS && radius != 1)) {
+        fprintf(stderr, "[%s] radius must be 1 for the cross and between "
+                "1 and %d for the square\n", __func__, MEDIAN_MAX_RADIUS);
+        exit(EXIT_FAILURE);
+    }
+
+    /* If we are on the edges we keep the rows as is */
+    for (y = y_start; y < y_end; ++y) {
+        if (y < radius || y >= src->height - radius || width < 2 * radius + 1) {
+            memcpy(image_row(dst, y), image_row(src, y), width);
+        }
+    }
+    if (width < 2 * radius + 1) {
+        return;
+    }
+    if (y_start < radius) {
+        y_start = radius;
+    }
+    if (y_end > src->height - radius) {
+        y_end = src->height - radius;
+    }
+    if (y_start >= y_end) {
+        return;
+    }
+
+    if (shape == MEDIAN_SQUARE && radius > 1) {
+        median_histogram_rows(src, dst, radius, y_start, y_end);
+        return;
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *mid = image_row(src, y);
+
+        if (shape == MEDIAN_CROSS) {
+            asm_median_cross_row_sse2(mid - src->stride, mid,
+                                      mid + src->stride, image_row(dst, y),
+                                      width);
+        } else {
+            asm_median3x3_row_sse2(mid - src->stride, mid, mid + src->stride,
+                                   image_row(dst, y), width);
+        }
+    }
+}
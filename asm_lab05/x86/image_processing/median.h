@@ -0,0 +1,43 @@
+/*
+ * File      : median.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Median filter engine working on bands of rows of grayscale images.
+ * The 5-point cross and the 3x3 window use SIMD sorting networks, larger
+ * windows a sliding histogram whose cost per pixel does not depend on
+ * the radius.
+ */
+
+#ifndef __MEDIAN_H__
+#define __MEDIAN_H__
+
+#include <stdint.h>
+
+#include "image_processing.h"
+
+/* Window shapes */
+#define MEDIAN_CROSS  0 /* Pixel and its 4 direct neighbours (radius 1) */
+#define MEDIAN_SQUARE 1 /* (2 x radius + 1)^2 pixels */
+
+/* Histogram counts are 16 bits, (2 x 127 + 1)^2 < 65536 */
+#define MEDIAN_MAX_RADIUS 127
+
+/* Median of the window centered on the pixel at x,y
+ * The pixels closer than radius to the edges are kept as is */
+uint8_t median_x_y(const image_container *img, int shape, int32_t radius,
+                   int32_t x, int32_t y);
+
+/* Median filter of the rows [y_start, y_end[ of src into dst, same
+ * result as median_x_y() on every pixel */
+void median_rows(const image_container *src, image_container *dst,
+                 int shape, int32_t radius, int32_t y_start, int32_t y_end);
+
+/* Median of one row, rows[j] is the source row y - radius + j.
+ * The left and right border pixels are copied. Larger squares than 3x3
+ * slide a histogram along the row (Huang), for filters that only see a
+ * few rows at a time */
+void median_row(const uint8_t *const *rows, uint8_t *dst, int32_t width,
+                int shape, int32_t radius);
+
+#endif /* __MEDIAN_H__ */
@@ -0,0 +1,272 @@
+/*
+ * File      : morphology.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "morphology.h"
+#include "thread_pool.h"
+
+/* A band is at least this many times the rows of the rectangle, the
+ * rows above and below a band go through the horizontal pass twice */
+#define MORPH_MIN_BAND_HEIGHTS 4
+
+/* Minimum and maximum of two rows, see asm_morphology.S */
+extern void asm_min_row_sse2(const uint8_t *a, const uint8_t *b,
+                             uint8_t *dest, int32_t size);
+extern void asm_max_row_sse2(const uint8_t *a, const uint8_t *b,
+                             uint8_t *dest, int32_t size);
+
+typedef struct {
+    const image_container *src;
+    image_container *dst;
+    int op;
+    int32_t width;
+    int32_t height;
+} morph_args;
+
+bool morph_parse(const char *arg, morph_filter *morph)
+{
+    static const char *const names[] = { "erode", "dilate", "open", "close" };
+    const char *size = strchr(arg, ':');
+    char end;
+    int op;
+
+    if (!size) {
+        return false;
+    }
+    for (op = 0; op < 4; ++op) {
+        if (!strncmp(arg, names[op], size - arg) &&
+            !names[op][size - arg]) {
+            break;
+        }
+    }
+    if (op == 4) {
+        return false;
+    }
+    morph->op = op;
+
+    if (sscanf(size + 1, "%dx%d%c", &morph->width, &morph->height,
+               &end) != 2) {
+        if (sscanf(size + 1, "%d%c", &morph->width, &end) != 1) {
+            return false;
+        }
+        morph->height = morph->width;
+    }
+    return morph->width >= 1 && morph->width <= MORPH_MAX_SIZE &&
+           morph->height >= 1 && morph->height <= MORPH_MAX_SIZE;
+}
+
+typedef void (*morph_pick_row)(const uint8_t *a, const uint8_t *b,
+                               uint8_t *dest, int32_t size);
+
+/* Horizontal pass of a row. The padded row (the pixels outside are
+ * neutral) is cut in blocks of size pixels from the left of the first
+ * window, g is the minimum from the start of the block and h the minimum
+ * up to the end of the block. A window covers the end of a block and the
+ * start of the next one, its minimum is min(h[i], g[i + size - 1]).
+ *
+ * The scans go from a pixel of a block to the next one, so the padded
+ * row is stored transposed, one line of nb_blocks pixels per position in
+ * the block : each step of the scans is then a pick_row() on two lines,
+ * for all the blocks at once. t and h hold size x nb_blocks pixels */
+static void morph_row(const uint8_t *src, uint8_t *dst, int32_t width,
+                      int32_t size, uint8_t *t, uint8_t *h,
+                      morph_pick_row pick_row, uint8_t neutral)
+{
+    const int32_t anchor = size / 2;
+    const int32_t nb_blocks = (width + 2 * size - 2) / size;
+    int32_t b, k, k_start, k_end;
+
+    /* Padded row, transposed. The block b holds the pixels from
+     * b * size - anchor */
+    memset(t, neutral, (size_t)size * nb_blocks);
+    for (b = 0; b < nb_blocks; ++b) {
+        const uint8_t *block = src + b * size - anchor;
+
+        k_start = anchor - b * size > 0 ? anchor - b * size : 0;
+        k_end = width + anchor - b * size < size ?
+                width + anchor - b * size : size;
+        for (k = k_start; k < k_end; ++k) {
+            t[(size_t)k * nb_blocks + b] = block[k];
+        }
+    }
+
+    /* h from the end of the blocks, then g in place of t */
+    memcpy(h + (size_t)(size - 1) * nb_blocks,
+           t + (size_t)(size - 1) * nb_blocks, nb_blocks);
+    for (k = size - 2; k >= 0; --k) {
+        pick_row(h + (size_t)(k + 1) * nb_blocks, t + (size_t)k * nb_blocks,
+                 h + (size_t)k * nb_blocks, nb_blocks);
+    }
+    for (k = 1; k < size; ++k) {
+        pick_row(t + (size_t)(k - 1) * nb_blocks, t + (size_t)k * nb_blocks,
+                 t + (size_t)k * nb_blocks, nb_blocks);
+    }
+
+    /* The window of the pixel k of the block b ends at the pixel k - 1
+     * of the block b + 1, or at the end of the block b when k is 0.
+     * The result goes in place of h */
+    pick_row(t + (size_t)(size - 1) * nb_blocks, h, h, nb_blocks);
+    for (k = 1; k < size; ++k) {
+        pick_row(t + (size_t)(k - 1) * nb_blocks + 1,
+                 h + (size_t)k * nb_blocks, h + (size_t)k * nb_blocks,
+                 nb_blocks - 1);
+    }
+
+    for (b = 0; b * size < width; ++b) {
+        k_end = width - b * size < size ? width - b * size : size;
+        for (k = 0; k < k_end; ++k) {
+            dst[b * size + k] = h[(size_t)k * nb_blocks + b];
+        }
+    }
+}
+
+static void *morph_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/* The vertical pass is the same algorithm on whole rows : the rows of
+ * the band and of its halo are cut in blocks of height rows, and each
+ * step is the minimum of two rows */
+void morph_rows(const image_container *src, image_container *dst, int op,
+                int32_t width, int32_t height,
+                int32_t y_start, int32_t y_end)
+{
+    const bool dilate = op == MORPH_DILATE;
+    const int32_t w = src->width;
+    const int32_t first = y_start - height / 2;
+    const int32_t n = y_end - y_start + height - 1;
+    const morph_pick_row pick_row = dilate ? asm_max_row_sse2 :
+                                             asm_min_row_sse2;
+    const uint8_t neutral = dilate ? 0 : UINT8_MAX;
+    /* Blocks of the padded rows of the horizontal pass, see morph_row() */
+    const size_t line_size = (size_t)w + 2 * (width - 1);
+    uint8_t *rows, *h, *t_line, *h_line;
+    int32_t i, y;
+
+    if (y_start >= y_end || !w) {
+        return;
+    }
+
+    rows = morph_alloc((size_t)n * w);
+    h = morph_alloc((size_t)n * w);
+    t_line = morph_alloc(line_size);
+    h_line = morph_alloc(line_size);
+
+    /* Horizontal pass of the rows of the band and its halo */
+    for (i = 0; i < n; ++i) {
+        uint8_t *row = rows + (size_t)i * w;
+
+        y = first + i;
+        if (y < 0 || y >= src->height) {
+            memset(row, neutral, w);
+        } else if (width == 1) {
+            memcpy(row, image_row(src, y), w);
+        } else {
+            morph_row(image_row(src, y), row, w, width, t_line, h_line,
+                      pick_row, neutral);
+        }
+    }
+
+    /* h from the end of the blocks, then g in place of the rows */
+    for (i = n - 1; i >= 0; --i) {
+        if (i % height == height - 1 || i == n - 1) {
+            memcpy(h + (size_t)i * w, rows + (size_t)i * w, w);
+        } else {
+            pick_row(h + (size_t)(i + 1) * w, rows + (size_t)i * w,
+                     h + (size_t)i * w, w);
+        }
+    }
+    for (i = 1; i < n; ++i) {
+        if (i % height) {
+            pick_row(rows + (size_t)(i - 1) * w, rows + (size_t)i * w,
+                     rows + (size_t)i * w, w);
+        }
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        i = y - y_start;
+        pick_row(h + (size_t)i * w, rows + (size_t)(i + height - 1) * w,
+                 image_row(dst, y), w);
+    }
+
+    free(rows);
+    free(h);
+    free(t_line);
+    free(h_line);
+}
+
+static void morph_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    morph_args *args = arg;
+
+    morph_rows(args->src, args->dst, args->op, args->width, args->height,
+               y_start, y_end);
+}
+
+/* One erosion or dilation of the whole image */
+static void morph_pass(const image_container *src, image_container *dst,
+                       int op, int32_t width, int32_t height)
+{
+    morph_args args = {
+        .src = src, .dst = dst, .op = op, .width = width, .height = height
+    };
+    int32_t band_rows = thread_pool_band_rows(2 * (size_t)src->width,
+                                              height / 2);
+
+    if (band_rows < MORPH_MIN_BAND_HEIGHTS * height) {
+        band_rows = MORPH_MIN_BAND_HEIGHTS * height;
+    }
+    thread_pool_run(morph_band, &args, src->height, band_rows);
+}
+
+image_container *morphology(const image_container *img,
+                            const morph_filter *morph)
+{
+    image_container *result, *tmp;
+
+    if (img->comp != COMPONENT_GRAYSCALE) {
+        fprintf(stderr, "[%s] only accepts grayscale images\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    result = allocate_container(img->width, img->height,
+                                COMPONENT_GRAYSCALE);
+
+    switch (morph->op) {
+    case MORPH_ERODE:
+    case MORPH_DILATE:
+        morph_pass(img, result, morph->op, morph->width, morph->height);
+        break;
+    default:
+        tmp = allocate_container(img->width, img->height,
+                                 COMPONENT_GRAYSCALE);
+        morph_pass(img, tmp,
+                   morph->op == MORPH_OPEN ? MORPH_ERODE : MORPH_DILATE,
+                   morph->width, morph->height);
+        morph_pass(tmp, result,
+                   morph->op == MORPH_OPEN ? MORPH_DILATE : MORPH_ERODE,
+                   morph->width, morph->height);
+        free_container(tmp);
+    }
+
+    return result;
+}
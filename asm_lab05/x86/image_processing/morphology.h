@@ -0,0 +1,50 @@
+/*
+ * File      : morphology.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Grayscale morphology with rectangular structuring elements. Erosion
+ * and dilation use the van Herk/Gil-Werman algorithm : 3 comparisons per
+ * pixel and pass whatever the size of the rectangle.
+ */
+
+#ifndef __MORPHOLOGY_H__
+#define __MORPHOLOGY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+
+/* Operations */
+#define MORPH_ERODE  0 /* Minimum of the rectangle */
+#define MORPH_DILATE 1 /* Maximum of the rectangle */
+#define MORPH_OPEN   2 /* Erosion then dilation */
+#define MORPH_CLOSE  3 /* Dilation then erosion */
+
+#define MORPH_MAX_SIZE 4095
+
+/* Operation and rectangle of width x height pixels, centered on the
+ * pixel (on the pixel right and below the center for even sizes) */
+typedef struct {
+    int op;
+    int32_t width;
+    int32_t height;
+} morph_filter;
+
+/* Reads op:size or op:widthxheight, op being erode, dilate, open or
+ * close. Returns false when it is not valid */
+bool morph_parse(const char *arg, morph_filter *morph);
+
+/* Erosion (MORPH_ERODE) or dilation (MORPH_DILATE) of the rows
+ * [y_start, y_end[ of src into dst. The pixels outside of the image are
+ * left out of the rectangle */
+void morph_rows(const image_container *src, image_container *dst, int op,
+                int32_t width, int32_t height,
+                int32_t y_start, int32_t y_end);
+
+/* Result of the operation on a grayscale image, on the thread pool */
+image_container *morphology(const image_container *img,
+                            const morph_filter *morph);
+
+#endif /* __MORPHOLOGY_H__ */
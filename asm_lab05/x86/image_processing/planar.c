@@ -0,0 +1,281 @@
+/*
+ * File      : planar.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "planar.h"
+#include "pnm.h"
+#include "thread_pool.h"
+
+typedef struct {
+    const planar_image *src_planar;
+    planar_image *dst_planar;
+    const image_container *img;
+    image_container *dst_img;
+    const conv_kernel *kernel;
+    const conv_border *border;
+} planar_args;
+
+void planar_alloc(planar_image *planar, int32_t width, int32_t height,
+                  int32_t planes)
+{
+    int32_t p;
+
+    if (planes < 1 || planes > PLANAR_MAX_PLANES) {
+        fprintf(stderr, "[%s] %d planes are not supported\n", __func__,
+                planes);
+        exit(EXIT_FAILURE);
+    }
+
+    planar->width = width;
+    planar->height = height;
+    planar->planes = planes;
+    planar->storage = allocate_container(width, (size_t)height * planes,
+                                         COMPONENT_GRAYSCALE);
+    for (p = 0; p < planes; ++p) {
+        planar->plane[p].width = width;
+        planar->plane[p].height = height;
+        planar->plane[p].comp = COMPONENT_GRAYSCALE;
+        /* The planes follow each other in the rows of the storage */
+        planar->plane[p].stride = planar->storage->stride;
+        planar->plane[p].data = image_row(planar->storage, p * height);
+        planar->plane[p].pooled = false;
+        planar->plane[p].map = NULL;
+        planar->plane[p].map_size = 0;
+    }
+}
+
+static void split_row_rgb(const uint8_t *src, uint8_t *const *dst,
+                          int32_t width)
+{
+    uint8_t *r = dst[R_OFFSET], *g = dst[G_OFFSET], *b = dst[B_OFFSET];
+    int32_t x;
+
+    for (x = 0; x < width; ++x, src += COMPONENT_RGB) {
+        r[x] = src[R_OFFSET];
+        g[x] = src[G_OFFSET];
+        b[x] = src[B_OFFSET];
+    }
+}
+
+static void split_row_rgba(const uint8_t *src, uint8_t *const *dst,
+                           int32_t width)
+{
+    uint8_t *r = dst[R_OFFSET], *g = dst[G_OFFSET], *b = dst[B_OFFSET];
+    uint8_t *a = dst[A_OFFSET];
+    int32_t x;
+
+    for (x = 0; x < width; ++x, src += COMPONENT_RGBA) {
+        r[x] = src[R_OFFSET];
+        g[x] = src[G_OFFSET];
+        b[x] = src[B_OFFSET];
+        a[x] = src[A_OFFSET];
+    }
+}
+
+/* Any number of components */
+static void split_row(const uint8_t *src, uint8_t *const *dst, int32_t width,
+                      int comp)
+{
+    int32_t x;
+    int p;
+
+    for (x = 0; x < width; ++x) {
+        for (p = 0; p < comp; ++p) {
+            dst[p][x] = src[x * comp + p];
+        }
+    }
+}
+
+static void merge_row_rgb(uint8_t *const *src, uint8_t *dst, int32_t width)
+{
+    const uint8_t *r = src[R_OFFSET], *g = src[G_OFFSET];
+    const uint8_t *b = src[B_OFFSET];
+    int32_t x;
+
+    for (x = 0; x < width; ++x, dst += COMPONENT_RGB) {
+        dst[R_OFFSET] = r[x];
+        dst[G_OFFSET] = g[x];
+        dst[B_OFFSET] = b[x];
+    }
+}
+
+static void merge_row_rgba(uint8_t *const *src, uint8_t *dst, int32_t width)
+{
+    const uint8_t *r = src[R_OFFSET], *g = src[G_OFFSET];
+    const uint8_t *b = src[B_OFFSET], *a = src[A_OFFSET];
+    int32_t x;
+
+    for (x = 0; x < width; ++x, dst += COMPONENT_RGBA) {
+        dst[R_OFFSET] = r[x];
+        dst[G_OFFSET] = g[x];
+        dst[B_OFFSET] = b[x];
+        dst[A_OFFSET] = a[x];
+    }
+}
+
+/* Any number of components */
+static void merge_row(uint8_t *const *src, uint8_t *dst, int32_t width,
+                      int comp)
+{
+    int32_t x;
+    int p;
+
+    for (x = 0; x < width; ++x) {
+        for (p = 0; p < comp; ++p) {
+            dst[x * comp + p] = src[p][x];
+        }
+    }
+}
+
+/* Rows of the planes at y */
+static void plane_rows(const planar_image *planar, int32_t y,
+                       uint8_t **rows)
+{
+    int32_t p;
+
+    for (p = 0; p < planar->planes; ++p) {
+        rows[p] = image_row(&planar->plane[p], y);
+    }
+}
+
+static void split_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    planar_args *args = arg;
+    const image_container *img = args->img;
+    uint8_t *rows[PLANAR_MAX_PLANES];
+    int32_t y;
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *src = image_row(img, y);
+
+        plane_rows(args->dst_planar, y, rows);
+        switch (img->comp) {
+        case COMPONENT_RGB:
+            split_row_rgb(src, rows, img->width);
+            break;
+        case COMPONENT_RGBA:
+            split_row_rgba(src, rows, img->width);
+            break;
+        default:
+            split_row(src, rows, img->width, img->comp);
+        }
+    }
+}
+
+static void merge_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    planar_args *args = arg;
+    image_container *img = args->dst_img;
+    uint8_t *rows[PLANAR_MAX_PLANES];
+    int32_t y;
+
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *dst = image_row(img, y);
+
+        plane_rows(args->src_planar, y, rows);
+        switch (img->comp) {
+        case COMPONENT_RGB:
+            merge_row_rgb(rows, dst, img->width);
+            break;
+        case COMPONENT_RGBA:
+            merge_row_rgba(rows, dst, img->width);
+            break;
+        default:
+            merge_row(rows, dst, img->width, img->comp);
+        }
+    }
+}
+
+void planar_split(planar_image *planar, const image_container *img)
+{
+    planar_args args = { .img = img, .dst_planar = planar };
+
+    planar_alloc(planar, img->width, img->height, img->comp);
+    thread_pool_run(split_band, &args, img->height,
+                    thread_pool_band_rows(2 * (size_t)img->width *
+                                          img->comp, 0));
+}
+
+image_container *planar_merge(const planar_image *planar)
+{
+    planar_args args = { .src_planar = planar };
+
+    args.dst_img = allocate_container(planar->width, planar->height,
+                                      planar->planes);
+    thread_pool_run(merge_band, &args, planar->height,
+                    thread_pool_band_rows(2 * (size_t)planar->width *
+                                          planar->planes, 0));
+    return args.dst_img;
+}
+
+/* The planes of a band are done one after the other, each with the
+ * rows of the grayscale engine : asm_filter_row_sse2() or
+ * asm_filter_row_avx2() for the 3x3 kernels without factor, the
+ * separable passes or the C rows for the other ones. The asm rows
+ * saturate before any division, so the blurs with a factor stay in C */
+static void convolve_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    planar_args *args = arg;
+    const planar_image *src = args->src_planar;
+    planar_image *dst = args->dst_planar;
+    const int32_t planes = src->planes == COMPONENT_RGBA ? A_OFFSET :
+                           src->planes;
+    int32_t p;
+
+    for (p = 0; p < planes; ++p) {
+        conv_rows(&src->plane[p], &dst->plane[p], args->kernel, args->border,
+                  y_start, y_end);
+    }
+    /* The alpha plane is not a color */
+    if (planes != src->planes) {
+        memcpy(image_row(&dst->plane[A_OFFSET], y_start),
+               image_row(&src->plane[A_OFFSET], y_start),
+               (size_t)(y_end - y_start) * src->plane[A_OFFSET].stride);
+    }
+}
+
+void planar_convolve(const planar_image *src, planar_image *dst,
+                     const conv_kernel *kernel, const conv_border *border)
+{
+    conv_kernel separated = *kernel;
+    planar_args args = {
+        .src_planar = src, .dst_planar = dst, .kernel = &separated,
+        .border = border
+    };
+
+    kernel_separate(&separated);
+    planar_alloc(dst, src->width, src->height, src->planes);
+    thread_pool_run(convolve_band, &args, src->height,
+                    thread_pool_band_rows(2 * (size_t)src->width *
+                                          src->planes, kernel->size / 2));
+}
+
+void planar_save(const char *path, const planar_image *planar)
+{
+    image_container *img;
+
+    if (pnm_format(path) == PNM_RAW) {
+        pnm_save(path, planar->storage);
+        return;
+    }
+    img = planar_merge(planar);
+    save_image(path, img);
+    free_container(img);
+}
+
+void planar_free(planar_image *planar)
+{
+    free_container(planar->storage);
+    planar->storage = NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * File      : planar.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Color images as planes (structure of arrays) : the RGB or RGBA pixels
+ * are split once into one grayscale plane per component, so every plane
+ * goes through the grayscale convolution engine without strided
+ * accesses. The planes may be merged back into interleaved pixels or
+ * stay planar for the next stages and the .raw files.
+ */
+
+#ifndef __PLANAR_H__
+#define __PLANAR_H__
+
+#include <stdint.h>
+
+#include "convolution.h"
+#include "image_processing.h"
+
+#define PLANAR_MAX_PLANES COMPONENT_RGBA
+
+typedef struct {
+    int32_t width;
+    int32_t height;
+    int32_t planes;
+    /* The planes one after the other, a grayscale image of width x
+     * (height x planes) pixels laid out as a planar .raw file */
+    image_container *storage;
+    /* Grayscale views of the planes in storage, not to be freed */
+    image_container plane[PLANAR_MAX_PLANES];
+} planar_image;
+
+/* Allocates the planes of an image */
+void planar_alloc(planar_image *planar, int32_t width, int32_t height,
+                  int32_t planes);
+
+/* Allocates the planes and splits the pixels of img into them */
+void planar_split(planar_image *planar, const image_container *img);
+
+/* Interleaved image of the planes */
+image_container *planar_merge(const planar_image *planar);
+
+/* Allocates dst and convolves each color plane of src into it, the
+ * alpha plane of RGBA images is copied. On the thread pool */
+void planar_convolve(const planar_image *src, planar_image *dst,
+                     const conv_kernel *kernel, const conv_border *border);
+
+/* Writes the planes as they are to .raw files, merged to other files */
+void planar_save(const char *path, const planar_image *planar);
+
+void planar_free(planar_image *planar);
+
+#endif /* __PLANAR_H__ */
@@ -0,0 +1,636 @@
+/*
+ * File      : png_stream.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "png_stream.h"
+#include "thread_pool.h"
+#include "lib/stb_image.h"
+
+#define PNG_COLOR_GRAY       0
+#define PNG_COLOR_RGB        2
+#define PNG_COLOR_GRAY_ALPHA 4
+#define PNG_COLOR_RGBA       6
+
+static const uint8_t png_signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+/* PNG color type of each number of components */
+static const uint8_t color_types[5] = {
+    0, PNG_COLOR_GRAY, PNG_COLOR_GRAY_ALPHA, PNG_COLOR_RGB, PNG_COLOR_RGBA };
+
+static void *alloc_or_exit(size_t size, const char *func)
+{
+    void *ptr = malloc(size);
+
+    if (!ptr) {
+        fprintf(stderr, "[%s] allocation error\n", func);
+        perror(func);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static uint8_t paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    if (pb <= pc) {
+        return b;
+    }
+    return c;
+}
+
+/**********
+ * Reader *
+ **********/
+
+/* Reads a chunk length and type, returns false at the end of file */
+static bool read_chunk_header(FILE *file, uint32_t *length, char type[4])
+{
+    uint8_t header[8];
+
+    if (fread(header, 1, 8, file) != 8) {
+        return false;
+    }
+    *length = get32(header);
+    memcpy(type, header + 4, 4);
+    return true;
+}
+
+/* Gives the content of the IDAT chunks to the inflater */
+static size_t read_idat(void *ctx, uint8_t *buf, size_t size)
+{
+    png_reader *reader = ctx;
+    uint32_t length;
+    char type[4];
+    size_t count;
+
+    while (reader->chunk_left == 0) {
+        if (reader->idat_end) {
+            return 0;
+        }
+        fseek(reader->file, 4, SEEK_CUR); /* CRC of the previous chunk */
+        if (!read_chunk_header(reader->file, &length, type) ||
+            memcmp(type, "IDAT", 4)) {
+            reader->idat_end = true;
+            return 0;
+        }
+        reader->chunk_left = length;
+    }
+
+    count = size < reader->chunk_left ? size : reader->chunk_left;
+    count = fread(buf, 1, count, reader->file);
+    if (count == 0) {
+        reader->idat_end = true;
+    }
+    reader->chunk_left -= count;
+
+    return count;
+}
+
+/* Parses the header, returns false when the image cannot be streamed */
+static bool read_png_header(png_reader *reader)
+{
+    uint8_t buf[13];
+    uint32_t length;
+    char type[4];
+
+    if (fread(buf, 1, 8, reader->file) != 8 ||
+        memcmp(buf, png_signature, 8) ||
+        !read_chunk_header(reader->file, &length, type) ||
+        memcmp(type, "IHDR", 4) || length != 13 ||
+        fread(buf, 1, 13, reader->file) != 13) {
+        return false;
+    }
+
+    reader->width = get32(buf);
+    reader->height = get32(buf + 4);
+    /* 8 bits, no palette, no interlacing */
+    if (buf[8] != 8 || buf[12] != 0 || reader->width <= 0 ||
+        reader->height <= 0) {
+        return false;
+    }
+    switch (buf[9]) {
+    case PNG_COLOR_GRAY:
+        reader->comp = 1;
+        break;
+    case PNG_COLOR_GRAY_ALPHA:
+        reader->comp = 2;
+        break;
+    case PNG_COLOR_RGB:
+        reader->comp = 3;
+        break;
+    case PNG_COLOR_RGBA:
+        reader->comp = 4;
+        break;
+    default:
+        return false;
+    }
+
+    /* The data starts at the first IDAT chunk */
+    fseek(reader->file, 4, SEEK_CUR);
+    for (;;) {
+        if (!read_chunk_header(reader->file, &length, type)) {
+            return false;
+        }
+        if (!memcmp(type, "IDAT", 4)) {
+            break;
+        }
+        fseek(reader->file, length + 4, SEEK_CUR);
+    }
+    reader->chunk_left = length;
+    reader->idat_end = false;
+
+    return true;
+}
+
+png_reader *png_reader_open(const char *path)
+{
+    png_reader *reader = alloc_or_exit(sizeof (png_reader), __func__);
+
+    reader->file = fopen(path, "rb"); /* Read Binary */
+    if (!reader->file) {
+        fprintf(stderr, "[%s] fopen error (%s)\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+    reader->inflater = NULL;
+    reader->row = NULL;
+    reader->prev = NULL;
+    reader->image = NULL;
+    reader->next_row = 0;
+
+    if (read_png_header(reader)) {
+        size_t stride = (size_t)reader->width * reader->comp;
+
+        reader->inflater = alloc_or_exit(sizeof (zlib_inflater), __func__);
+        zlib_inflate_init(reader->inflater, read_idat, reader);
+        reader->row = alloc_or_exit(stride + 1, __func__);
+        reader->prev = calloc(stride, 1);
+        if (!reader->prev) {
+            fprintf(stderr, "[%s] allocation error\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        fclose(reader->file);
+        reader->file = NULL;
+        reader->image = stbi_load(path, &reader->width, &reader->height,
+                                  &reader->comp, 0);
+        if (!reader->image) {
+            fprintf(stderr, "[%s] stb load image failed\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return reader;
+}
+
+void png_reader_read_row(png_reader *reader, uint8_t *row)
+{
+    const size_t stride = (size_t)reader->width * reader->comp;
+    const int bpp = reader->comp;
+    uint8_t *filtered = reader->row + 1;
+    uint8_t *prev = reader->prev;
+    size_t i;
+
+    if (reader->next_row >= reader->height) {
+        fprintf(stderr, "[%s] no more rows\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    if (reader->image) {
+        memcpy(row, reader->image + reader->next_row++ * stride, stride);
+        return;
+    }
+
+    if (zlib_inflate(reader->inflater, reader->row, stride + 1) !=
+        stride + 1) {
+        fprintf(stderr, "[%s] image data is truncated\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    switch (reader->row[0]) {
+    case 0: /* None */
+        memcpy(row, filtered, stride);
+        break;
+    case 1: /* Sub */
+        for (i = 0; i < stride; ++i) {
+            row[i] = filtered[i] + (i < bpp ? 0 : row[i - bpp]);
+        }
+        break;
+    case 2: /* Up */
+        for (i = 0; i < stride; ++i) {
+            row[i] = filtered[i] + prev[i];
+        }
+        break;
+    case 3: /* Average */
+        for (i = 0; i < stride; ++i) {
+            row[i] = filtered[i] +
+                     (((i < bpp ? 0 : row[i - bpp]) + prev[i]) >> 1);
+        }
+        break;
+    case 4: /* Paeth */
+        for (i = 0; i < stride; ++i) {
+            row[i] = filtered[i] +
+                     paeth(i < bpp ? 0 : row[i - bpp], prev[i],
+                           i < bpp ? 0 : prev[i - bpp]);
+        }
+        break;
+    default:
+        fprintf(stderr, "[%s] unknown filter type %d\n", __func__,
+                reader->row[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(prev, row, stride);
+    reader->next_row++;
+}
+
+void png_reader_close(png_reader *reader)
+{
+    if (!reader) {
+        return;
+    }
+    if (reader->file) {
+        fclose(reader->file);
+    }
+    if (reader->image) {
+        stbi_image_free(reader->image);
+    }
+    free(reader->inflater);
+    free(reader->row);
+    free(reader->prev);
+    free(reader);
+}
+
+/**********
+ * Writer *
+ **********/
+
+static void write_chunk(FILE *file, const char *type,
+                        const uint8_t *data, size_t size)
+{
+    uint8_t buf[8];
+    uint32_t crc;
+
+    put32(buf, size);
+    memcpy(buf + 4, type, 4);
+    crc = crc32_update(0, buf + 4, 4);
+    crc = crc32_update(crc, data, size);
+
+    fwrite(buf, 1, 8, file);
+    fwrite(data, 1, size, file);
+    put32(buf, crc);
+    if (fwrite(buf, 1, 4, file) != 4) {
+        fprintf(stderr, "[%s] write error\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Compressed data is cut in IDAT chunks */
+static void write_idat(void *ctx, const uint8_t *buf, size_t size)
+{
+    png_writer *writer = ctx;
+
+    while (size) {
+        size_t room = PNG_CHUNK_SIZE - writer->chunk_len;
+        size_t count = size < room ? size : room;
+
+        memcpy(writer->chunk + writer->chunk_len, buf, count);
+        writer->chunk_len += count;
+        buf += count;
+        size -= count;
+
+        if (writer->chunk_len == PNG_CHUNK_SIZE) {
+            write_chunk(writer->file, "IDAT", writer->chunk,
+                        writer->chunk_len);
+            writer->chunk_len = 0;
+        }
+    }
+}
+
+/* Creates the file and writes the signature and the IHDR chunk */
+static FILE *write_header(const char *path, int width, int height, int comp)
+{
+    uint8_t header[13];
+    FILE *file;
+
+    if (comp < 1 || comp > 4 || width <= 0 || height <= 0) {
+        fprintf(stderr, "[%s] invalid image format\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "[%s] fopen error (%s)\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(png_signature, 1, 8, file);
+    put32(header, width);
+    put32(header + 4, height);
+    header[8] = 8;                  /* Bit depth */
+    header[9] = color_types[comp];
+    header[10] = 0;                 /* Deflate */
+    header[11] = 0;                 /* Adaptive filtering */
+    header[12] = 0;                 /* No interlacing */
+    write_chunk(file, "IHDR", header, 13);
+
+    return file;
+}
+
+/* Filters row with the 5 filters into filtered (5 x (stride + 1) bytes)
+ * and returns the filter type byte and row of the best one */
+static const uint8_t *filter_row(const uint8_t *row, const uint8_t *prev,
+                                 size_t stride, int bpp, uint8_t *filtered)
+{
+    uint32_t best_sum = UINT32_MAX;
+    int best = 0;
+
+    /* Every filter is tried, the one with the smallest sum of the
+     * absolute signed values usually compresses best */
+    for (int type = 0; type < 5; ++type) {
+        uint8_t *out = filtered + type * (stride + 1);
+        uint32_t sum = 0;
+
+        out[0] = type;
+        for (size_t i = 0; i < stride; ++i) {
+            int left = i < bpp ? 0 : row[i - bpp];
+            int up_left = i < bpp ? 0 : prev[i - bpp];
+            uint8_t value;
+
+            switch (type) {
+            case 0:
+                value = row[i];
+                break;
+            case 1:
+                value = row[i] - left;
+                break;
+            case 2:
+                value = row[i] - prev[i];
+                break;
+            case 3:
+                value = row[i] - ((left + prev[i]) >> 1);
+                break;
+            default:
+                value = row[i] - paeth(left, prev[i], up_left);
+                break;
+            }
+            out[i + 1] = value;
+            sum += abs((int8_t)value);
+        }
+        if (sum < best_sum) {
+            best_sum = sum;
+            best = type;
+        }
+    }
+
+    return filtered + best * (stride + 1);
+}
+
+png_writer *png_writer_open(const char *path, int width, int height,
+                            int comp, int level)
+{
+    png_writer *writer;
+    size_t stride = (size_t)width * comp;
+
+    writer = alloc_or_exit(sizeof (png_writer), __func__);
+    writer->file = write_header(path, width, height, comp);
+    writer->width = width;
+    writer->height = height;
+    writer->comp = comp;
+    writer->chunk_len = 0;
+    writer->next_row = 0;
+    writer->prev = calloc(stride, 1);
+    writer->filtered = alloc_or_exit(5 * (stride + 1), __func__);
+    if (!writer->prev) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    zlib_deflate_init(&writer->deflater, level, write_idat, writer);
+
+    return writer;
+}
+
+void png_writer_write_row(png_writer *writer, const uint8_t *row)
+{
+    const size_t stride = (size_t)writer->width * writer->comp;
+
+    zlib_deflate_write(&writer->deflater,
+                       filter_row(row, writer->prev, stride, writer->comp,
+                                  writer->filtered),
+                       stride + 1);
+    memcpy(writer->prev, row, stride);
+    writer->next_row++;
+}
+
+void png_writer_close(png_writer *writer)
+{
+    if (writer->next_row != writer->height) {
+        fprintf(stderr, "[%s] %d rows written instead of %d\n", __func__,
+                writer->next_row, writer->height);
+        exit(EXIT_FAILURE);
+    }
+
+    zlib_deflate_finish(&writer->deflater);
+    if (writer->chunk_len) {
+        write_chunk(writer->file, "IDAT", writer->chunk, writer->chunk_len);
+    }
+    write_chunk(writer->file, "IEND", NULL, 0);
+
+    fclose(writer->file);
+    free(writer->prev);
+    free(writer->filtered);
+    free(writer);
+}
+
+/****************
+ * Whole images *
+ ****************/
+
+/* Compressed data of a strip of rows */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint32_t adler;        /* Of the filtered rows of the strip */
+} png_strip;
+
+typedef struct {
+    const uint8_t *data;
+    size_t data_stride;    /* Bytes from a row of data to the next */
+    int width;
+    int height;
+    int comp;
+    int level;
+    int32_t strip_rows;
+    int32_t nb_strips;
+    png_strip *strips;
+} png_image_job;
+
+static void strip_write(void *ctx, const uint8_t *buf, size_t size)
+{
+    png_strip *strip = ctx;
+
+    if (strip->size + size > strip->capacity) {
+        strip->capacity = 2 * (strip->size + size);
+        strip->data = realloc(strip->data, strip->capacity);
+        if (!strip->data) {
+            fprintf(stderr, "[%s] allocation error\n", __func__);
+            perror(__func__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(strip->data + strip->size, buf, size);
+    strip->size += size;
+}
+
+/* Filters and compresses the strips [s_start, s_end[ in raw deflate
+ * streams. The rows of the window before a strip are filtered again to
+ * be its dictionary, so the strip compresses as well as in one stream */
+static void png_image_strips(void *arg, int32_t s_start, int32_t s_end)
+{
+    const png_image_job *job = arg;
+    const size_t stride = (size_t)job->width * job->comp;
+    const int32_t dict_rows = (ZLIB_WINDOW_SIZE + stride) / (stride + 1);
+    uint8_t *filtered = alloc_or_exit(5 * (stride + 1), __func__);
+    uint8_t *dict = alloc_or_exit(dict_rows * (stride + 1), __func__);
+    uint8_t *zeros = calloc(stride, 1);
+    zlib_deflater z;
+    int32_t s, y;
+
+    if (!zeros) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    for (s = s_start; s < s_end; ++s) {
+        png_strip *strip = &job->strips[s];
+        const int32_t y_start = s * job->strip_rows;
+        const int32_t y_end = y_start + job->strip_rows < job->height ?
+                              y_start + job->strip_rows : job->height;
+        const int32_t y_dict = y_start > dict_rows ? y_start - dict_rows : 0;
+        const uint8_t *row, *prev;
+
+        zlib_deflate_init_raw(&z, job->level, strip_write, strip);
+        if (s == 0) {
+            uint8_t header[2];
+
+            zlib_header(z.level, header);
+            strip_write(strip, header, 2);
+        }
+
+        for (y = y_dict; y < y_end; ++y) {
+            row = job->data + y * job->data_stride;
+            prev = y ? row - job->data_stride : zeros;
+            if (y < y_start) {
+                memcpy(dict + (y - y_dict) * (stride + 1),
+                       filter_row(row, prev, stride, job->comp, filtered),
+                       stride + 1);
+                continue;
+            }
+            if (y == y_start) {
+                zlib_deflate_set_dictionary(&z, dict,
+                                            (y_start - y_dict) * (stride + 1));
+            }
+            zlib_deflate_write(&z, filter_row(row, prev, stride, job->comp,
+                                              filtered), stride + 1);
+        }
+
+        /* Sync flush, the next strip starts on a byte boundary */
+        if (s == job->nb_strips - 1) {
+            zlib_deflate_finish(&z);
+        } else {
+            zlib_deflate_flush(&z);
+            zlib_deflate_release(&z);
+        }
+        strip->adler = z.adler;
+    }
+
+    free(filtered);
+    free(dict);
+    free(zeros);
+}
+
+void png_write_image(const char *path, const uint8_t *data, int width,
+                     int height, int comp, int data_stride, int level)
+{
+    const size_t stride = (size_t)width * comp;
+    png_image_job job = {
+        .data = data, .data_stride = data_stride, .width = width,
+        .height = height, .comp = comp, .level = level
+    };
+    uint32_t adler = 1;
+    uint8_t trailer[4];
+    FILE *file;
+    int32_t s;
+    size_t pos;
+
+    file = write_header(path, width, height, comp);
+
+    job.strip_rows = PNG_STRIP_SIZE / (stride + 1);
+    if (job.strip_rows < 1) {
+        job.strip_rows = 1;
+    }
+    job.nb_strips = (height + job.strip_rows - 1) / job.strip_rows;
+    job.strips = calloc(job.nb_strips, sizeof (png_strip));
+    if (!job.strips) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    thread_pool_run(png_image_strips, &job, job.nb_strips, 1);
+
+    /* The strips follow each other in one zlib stream, the Adler-32 of
+     * the rows is the combination of the Adler-32 of the strips */
+    for (s = 0; s < job.nb_strips; ++s) {
+        png_strip *strip = &job.strips[s];
+        int32_t rows = s == job.nb_strips - 1 ?
+                       height - s * job.strip_rows : job.strip_rows;
+
+        adler = adler32_combine(adler, strip->adler, rows * (stride + 1));
+        if (s == job.nb_strips - 1) {
+            put32(trailer, adler);
+            strip_write(strip, trailer, 4);
+        }
+        for (pos = 0; pos < strip->size; pos += PNG_CHUNK_SIZE) {
+            write_chunk(file, "IDAT", strip->data + pos,
+                        strip->size - pos < PNG_CHUNK_SIZE ?
+                        strip->size - pos : PNG_CHUNK_SIZE);
+        }
+        free(strip->data);
+    }
+    write_chunk(file, "IEND", NULL, 0);
+
+    fclose(file);
+    free(job.strips);
+}
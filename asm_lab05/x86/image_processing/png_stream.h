@@ -0,0 +1,76 @@
+/*
+ * File      : png_stream.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Row by row PNG decoding and encoding, only a few rows are kept in
+ * memory whatever the height of the image.
+ */
+
+#ifndef __PNG_STREAM_H__
+#define __PNG_STREAM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "zlib_stream.h"
+
+#define PNG_CHUNK_SIZE 65536 /* Size of the IDAT chunks written */
+/* Rows filtered and compressed together by png_write_image() */
+#define PNG_STRIP_SIZE (128 * 1024)
+
+typedef struct {
+    FILE *file;
+    int width;
+    int height;
+    int comp;
+
+    zlib_inflater *inflater;
+    uint32_t chunk_left;   /* Bytes left in the current IDAT chunk */
+    bool idat_end;
+    uint8_t *row;          /* Filter type and filtered row */
+    uint8_t *prev;         /* Previous unfiltered row */
+    int next_row;
+
+    /* PNG that cannot be streamed (palette, 16 bits, interlaced, ...)
+     * or other formats are decoded at once by stb */
+    uint8_t *image;
+} png_reader;
+
+typedef struct {
+    FILE *file;
+    int width;
+    int height;
+    int comp;
+
+    zlib_deflater deflater;
+    uint8_t *prev;         /* Previous row, zeros for the first one */
+    uint8_t *filtered;     /* Filter type and row for the 5 filters */
+    uint8_t chunk[PNG_CHUNK_SIZE];
+    size_t chunk_len;
+    int next_row;
+} png_writer;
+
+/* Opens an image and reads its header, exits on error */
+png_reader *png_reader_open(const char *path);
+/* Reads the next row (width x comp bytes) */
+void png_reader_read_row(png_reader *reader, uint8_t *row);
+void png_reader_close(png_reader *reader);
+
+/* Creates a PNG file for an image of comp components (1 to 4) */
+png_writer *png_writer_open(const char *path, int width, int height,
+                            int comp, int level);
+/* Writes the next row (width x comp bytes) */
+void png_writer_write_row(png_writer *writer, const uint8_t *row);
+/* Ends the file once all the rows have been written */
+void png_writer_close(png_writer *writer);
+
+/* Writes a whole image, whose rows are data_stride bytes apart. Strips
+ * of PNG_STRIP_SIZE bytes are filtered and compressed in parallel on the
+ * thread pool, each ends with a sync flush so they are concatenated into
+ * one zlib stream. level : see zlib_deflater */
+void png_write_image(const char *path, const uint8_t *data, int width,
+                     int height, int comp, int data_stride, int level);
+
+#endif /* __PNG_STREAM_H__ */
@@ -0,0 +1,331 @@
+/*
+ * File      : pnm.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _DEFAULT_SOURCE /* madvise() and posix_fallocate() */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pnm.h"
+
+#define PNM_HEADER_SIZE 64 /* "P5\n<width> <height>\n255\n" */
+#define PNM_MAX_VALUE   255
+#define PNM_MAX_VALUE16 65535
+
+int pnm_format(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    if (!ext || strchr(ext, '/')) {
+        return PNM_NONE;
+    }
+    if (!strcasecmp(ext, ".pgm") || !strcasecmp(ext, ".ppm") ||
+        !strcasecmp(ext, ".pnm")) {
+        return PNM_PNM;
+    }
+    if (!strcasecmp(ext, ".raw")) {
+        return PNM_RAW;
+    }
+    return PNM_NONE;
+}
+
+bool pnm_raw_parse(const char *arg, raw_geometry *raw)
+{
+    char end;
+
+    raw->planes = COMPONENT_GRAYSCALE;
+    if (sscanf(arg, "%dx%d%c", &raw->width, &raw->height, &end) != 2 &&
+        sscanf(arg, "%dx%dx%d%c", &raw->width, &raw->height, &raw->planes,
+               &end) != 3) {
+        return false;
+    }
+    return raw->width > 0 && raw->height > 0 &&
+           (raw->planes == COMPONENT_GRAYSCALE ||
+            raw->planes == COMPONENT_RGB || raw->planes == COMPONENT_RGBA);
+}
+
+/* Reads a number of the header at *pos, after spaces and comments */
+static bool header_number(const uint8_t *header, size_t size, size_t *pos,
+                          int32_t *value)
+{
+    while (*pos < size) {
+        if (header[*pos] == '#') {
+            while (*pos < size && header[*pos] != '\n') {
+                ++*pos;
+            }
+        } else if (isspace(header[*pos])) {
+            ++*pos;
+        } else {
+            break;
+        }
+    }
+    if (*pos == size || !isdigit(header[*pos])) {
+        return false;
+    }
+
+    *value = 0;
+    while (*pos < size && isdigit(header[*pos])) {
+        if (*value > (INT32_MAX - 9) / 10) {
+            return false;
+        }
+        *value = *value * 10 + header[(*pos)++] - '0';
+    }
+    return true;
+}
+
+/* Moves the raw planes of a mapping to an interleaved container */
+static image_container *raw_interleave(const uint8_t *planes,
+                                       const raw_geometry *raw)
+{
+    const size_t plane_size = (size_t)raw->width * raw->height;
+    image_container *img = allocate_container(raw->width, raw->height,
+                                              raw->planes);
+    const uint8_t *plane_row;
+    uint8_t *row;
+    int32_t p, x, y;
+
+    for (y = 0; y < raw->height; ++y) {
+        row = image_row(img, y);
+        for (p = 0; p < raw->planes; ++p) {
+            plane_row = planes + p * plane_size + (size_t)y * raw->width;
+            for (x = 0; x < raw->width; ++x) {
+                row[x * raw->planes + p] = plane_row[x];
+            }
+        }
+    }
+    return img;
+}
+
+image_container *pnm_load(const char *path, const raw_geometry *raw)
+{
+    const int format = pnm_format(path);
+    image_container *img;
+    struct stat st;
+    uint8_t *map;
+    size_t size, pos = 2;
+    int32_t width, height, comp, max_value;
+    int fd;
+
+    if (format == PNM_RAW && (!raw || raw->width <= 0)) {
+        fprintf(stderr, "[%s] the size of %s is needed (-R)\n", __func__,
+                path);
+        exit(EXIT_FAILURE);
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "[%s] open error (%s)\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    size = st.st_size;
+    if (!size) {
+        fprintf(stderr, "[%s] %s is empty\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Private so the filters may write in the source without changing
+     * the file, only the pages written are copied */
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "[%s] mmap error (%s)\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    /* Read ahead the whole file, the bands are read by several threads */
+    madvise(map, size, MADV_WILLNEED);
+
+    if (format == PNM_RAW) {
+        width = raw->width;
+        height = raw->height;
+        comp = raw->planes;
+        pos = 0;
+    } else if (size < 3 || map[0] != 'P' || (map[1] != '5' && map[1] != '6') ||
+               !header_number(map, size, &pos, &width) ||
+               !header_number(map, size, &pos, &height) ||
+               !header_number(map, size, &pos, &max_value) ||
+               pos == size || !isspace(map[pos++]) ||
+               !width || !height || max_value != PNM_MAX_VALUE) {
+        /* The samples are used as they are, other max values would need
+         * a rescale on load */
+        fprintf(stderr, "[%s] %s is not a binary 8 bits PGM or PPM "
+                "(max value 255)\n", __func__, path);
+        exit(EXIT_FAILURE);
+    } else {
+        comp = map[1] == '5' ? COMPONENT_GRAYSCALE : COMPONENT_RGB;
+    }
+
+    if ((size - pos) / comp / width < (size_t)height) {
+        fprintf(stderr, "[%s] %s is too short for %dx%dx%d\n", __func__,
+                path, width, height, comp);
+        exit(EXIT_FAILURE);
+    }
+
+    if (format == PNM_RAW && comp != COMPONENT_GRAYSCALE) {
+        img = raw_interleave(map, raw);
+        munmap(map, size);
+    } else {
+        img = malloc(sizeof (image_container));
+        if (!img) {
+            fprintf(stderr, "[%s] struct allocation error\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        img->width = width;
+        img->height = height;
+        img->comp = comp;
+        img->stride = width * comp; /* Rows of the file, not padded */
+        img->data = map + pos;
+        img->pooled = false;
+        img->map = map;
+        img->map_size = size;
+    }
+
+    fprintf(stdout, "[%s] image %s mapped (%d components, %dx%d)\n", __func__,
+            path, img->comp, img->width, img->height);
+    return img;
+}
+
+/* Creates the file at path with size bytes and maps it.
+ * The blocks are allocated first, a full disk is an error here instead of
+ * a SIGBUS when the pages are written */
+static uint8_t *map_new_file(const char *path, size_t size)
+{
+    uint8_t *map;
+    int fd, error;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[%s] open error (%s)\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    error = posix_fallocate(fd, 0, size);
+    if (error) {
+        fprintf(stderr, "[%s] cannot allocate %s (%s)\n", __func__, path,
+                strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "[%s] mmap error (%s)\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return map;
+}
+
+void pnm_save(const char *path, const image_container *img)
+{
+    const int format = pnm_format(path);
+    const size_t plane_size = (size_t)img->width * img->height;
+    const size_t row_size = (size_t)img->width * img->comp;
+    char header[PNM_HEADER_SIZE];
+    size_t header_size = 0, size;
+    const uint8_t *row;
+    uint8_t *map;
+    int p, x, y;
+
+    if (format == PNM_PNM) {
+        if (img->comp != COMPONENT_GRAYSCALE && img->comp != COMPONENT_RGB) {
+            fprintf(stderr, "[%s] PGM and PPM files have 1 or 3 "
+                    "components, not %d\n", __func__, img->comp);
+            exit(EXIT_FAILURE);
+        }
+        header_size = snprintf(header, sizeof (header), "P%c\n%d %d\n%d\n",
+                               img->comp == COMPONENT_GRAYSCALE ? '5' : '6',
+                               img->width, img->height, PNM_MAX_VALUE);
+    }
+    size = header_size + plane_size * img->comp;
+    map = map_new_file(path, size);
+
+    memcpy(map, header, header_size);
+    if (format == PNM_RAW && img->comp != COMPONENT_GRAYSCALE) {
+        for (y = 0; y < img->height; ++y) {
+            row = image_row(img, y);
+            for (p = 0; p < img->comp; ++p) {
+                uint8_t *plane_row = map + p * plane_size +
+                                     (size_t)y * img->width;
+
+                for (x = 0; x < img->width; ++x) {
+                    plane_row[x] = row[x * img->comp + p];
+                }
+            }
+        }
+    } else {
+        for (y = 0; y < img->height; ++y) {
+            memcpy(map + header_size + y * row_size, image_row(img, y),
+                   row_size);
+        }
+    }
+    munmap(map, size);
+
+    fprintf(stdout, "[%s] %s file %s saved (%dx%d)\n", __func__,
+            format == PNM_RAW ? "Raw" : "PNM", path, img->width, img->height);
+}
+
+void pnm_save16(const char *path, const uint16_t *data, int32_t width,
+                int32_t height, int32_t stride)
+{
+    const int format = pnm_format(path);
+    const size_t row_size = (size_t)width * sizeof (uint16_t);
+    char header[PNM_HEADER_SIZE];
+    size_t header_size = 0, size;
+    uint8_t *map;
+    int32_t x, y;
+
+    if (format == PNM_NONE) {
+        fprintf(stderr, "[%s] 16 bits images are saved to .pgm or .raw "
+                "files, not %s\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+    if (format == PNM_PNM) {
+        header_size = snprintf(header, sizeof (header), "P5\n%d %d\n%d\n",
+                               width, height, PNM_MAX_VALUE16);
+    }
+    size = header_size + row_size * height;
+    map = map_new_file(path, size);
+
+    memcpy(map, header, header_size);
+    for (y = 0; y < height; ++y) {
+        const uint16_t *row = data + (size_t)y * stride;
+        uint8_t *out = map + header_size + y * row_size;
+
+        if (format == PNM_RAW) {
+            memcpy(out, row, row_size);
+            continue;
+        }
+        /* The samples of a PGM are big endian */
+        for (x = 0; x < width; ++x) {
+            out[2 * x] = row[x] >> 8;
+            out[2 * x + 1] = row[x] & 0xff;
+        }
+    }
+    munmap(map, size);
+
+    fprintf(stdout, "[%s] %s file %s saved (%dx%d, 16 bits)\n", __func__,
+            format == PNM_RAW ? "Raw" : "PNM", path, width, height);
+}
+
+void pnm_unmap(image_container *img)
+{
+    munmap(img->map, img->map_size);
+    img->map = NULL;
+    img->data = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * File      : pnm.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * PGM/PPM (binary P5 and P6, max value 255) and raw planar images mapped in
+ * memory. There is nothing to decode or encode : the pixels of a loaded
+ * image are the pages of the file and a saved image is copied in the
+ * pages of a file allocated at its final size.
+ */
+
+#ifndef __PNM_H__
+#define __PNM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+
+/* File formats, from the extension */
+#define PNM_NONE 0 /* Other formats, see load_image() and save_image() */
+#define PNM_PNM  1 /* .pgm, .ppm and .pnm */
+#define PNM_RAW  2 /* .raw : planes of width x height bytes, no header */
+
+/* Size of a raw image, which is not in the file */
+typedef struct {
+    int32_t width;
+    int32_t height;
+    int32_t planes; /* 1 (grayscale), 3 (RGB) or 4 (RGBA) */
+} raw_geometry;
+
+/* Format of the file at path */
+int pnm_format(const char *path);
+
+/* Reads a raw geometry : widthxheight[xplanes].
+ * Returns false when it is not valid */
+bool pnm_raw_parse(const char *arg, raw_geometry *raw);
+
+/* Maps the image at path, raw gives the size of a raw image.
+ * A grayscale image is not copied, the data of the container is in the
+ * mapping (copy on write). Raw color planes are interleaved into a
+ * container of allocate_container() */
+image_container *pnm_load(const char *path, const raw_geometry *raw);
+
+/* Writes img to a PGM (1 component), PPM (3 components) or raw file.
+ * The file is allocated at its size then mapped, the header and the
+ * pixels are copied to the mapping */
+void pnm_save(const char *path, const image_container *img);
+
+/* Writes the 16 bits grayscale image data, stride pixels from a row to
+ * the next, to a PGM (maxval 65535, big endian samples) or raw file
+ * (little endian, as in memory) */
+void pnm_save16(const char *path, const uint16_t *data, int32_t width,
+                int32_t height, int32_t stride);
+
+/* Releases the mapping of a container from pnm_load() */
+void pnm_unmap(image_container *img);
+
+#endif /* __PNM_H__ */
@@ -0,0 +1,429 @@
+/*
+ * File      : pyramid.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pyramid.h"
+#include "thread_pool.h"
+
+#define PYRAMID_TAPS    5
+#define EXPAND_TAPS     3
+#define BILINEAR_SHIFT  8
+#define BILINEAR_ONE    (1 << BILINEAR_SHIFT)
+
+/* Means of the 2x2 blocks of two rows, see asm_downscale.S */
+extern void asm_downscale2_row_sse2(const uint8_t *top,
+                                    const uint8_t *bottom,
+                                    uint8_t *dest, int32_t width);
+/* Vertical passes, see asm_pyramid.S */
+extern void asm_reduce_col_sse2(const uint16_t *const *rows, uint8_t *dest,
+                                int32_t size);
+extern void asm_expand_col_sse2(const uint16_t *const *rows, uint8_t *dest,
+                                int32_t size, int32_t odd);
+extern void asm_bilinear_col_sse2(const uint8_t *top, const uint8_t *bottom,
+                                  uint16_t *dest, int32_t size,
+                                  int32_t weight);
+
+static const uint16_t binomial[PYRAMID_TAPS] = { 1, 4, 6, 4, 1 };
+
+typedef struct {
+    const image_container *src;
+    image_container *dst;
+    /* Bilinear : source components left and right of each component of
+     * a row of dst, and the weight of the right one */
+    const int32_t *x_left;
+    const int32_t *x_right;
+    const int32_t *x_weight;
+} pyramid_args;
+
+static void *pyramid_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static inline int32_t clamp_index(int32_t i, int32_t size)
+{
+    return i < 0 ? 0 : i >= size ? size - 1 : i;
+}
+
+bool pyramid_size_parse(const char *arg, int32_t *width, int32_t *height)
+{
+    char end;
+
+    return sscanf(arg, "%dx%d%c", width, height, &end) == 2 &&
+           *width > 0 && *height > 0;
+}
+
+static void downscale2_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    pyramid_args *args = arg;
+    const image_container *src = args->src;
+    image_container *dst = args->dst;
+    const int32_t comp = src->comp;
+    int32_t x, y, x0, x1, c;
+
+    for (y = y_start; y < y_end; ++y) {
+        const uint8_t *top = image_row(src, 2 * y);
+        const uint8_t *bottom = image_row(src,
+                                          clamp_index(2 * y + 1, src->height));
+        uint8_t *row = image_row(dst, y);
+
+        if (comp == COMPONENT_GRAYSCALE) {
+            asm_downscale2_row_sse2(top, bottom, row, src->width / 2);
+            if (src->width & 1) {
+                x = src->width - 1;
+                row[x / 2] = (top[x] + bottom[x] + 1) >> 1;
+            }
+            continue;
+        }
+        for (x = 0; x < dst->width; ++x) {
+            x0 = 2 * x * comp;
+            x1 = clamp_index(2 * x + 1, src->width) * comp;
+            for (c = 0; c < comp; ++c) {
+                row[x * comp + c] = (top[x0 + c] + top[x1 + c] +
+                                     bottom[x0 + c] + bottom[x1 + c] + 2) >> 2;
+            }
+        }
+    }
+}
+
+image_container *downscale2(const image_container *img)
+{
+    pyramid_args args = { .src = img };
+
+    args.dst = allocate_container((img->width + 1) / 2,
+                                  (img->height + 1) / 2, img->comp);
+    thread_pool_run(downscale2_band, &args, args.dst->height,
+                    thread_pool_band_rows(3 * (size_t)img->width *
+                                          img->comp, 0));
+    return args.dst;
+}
+
+/* Position of the center of the pixel i of the new size in the source,
+ * rounded to fixed point, clamped to the first and last pixels */
+static void bilinear_position(int32_t i, int32_t size, int32_t src_size,
+                              int32_t *left, int32_t *right,
+                              int32_t *weight)
+{
+    int64_t pos = (int64_t)(2 * i + 1) * src_size - size;
+
+    pos = pos < 0 ? 0 : (pos * BILINEAR_ONE + size) / (2 * size);
+    *left = pos >> BILINEAR_SHIFT;
+    *weight = pos & (BILINEAR_ONE - 1);
+    if (*left >= src_size - 1) {
+        *left = src_size - 1;
+        *weight = 0;
+    }
+    *right = *left + (*weight ? 1 : 0);
+}
+
+/* The two source rows are first blended with the vertical weight, by
+ * vectors since their components follow each other. The horizontal
+ * taps are then read at any position, in C. Same sums as the four
+ * products of each pixel, in integers */
+static void bilinear_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    pyramid_args *args = arg;
+    const image_container *src = args->src;
+    image_container *dst = args->dst;
+    const int32_t size = dst->width * dst->comp;
+    const int32_t src_size = src->width * src->comp;
+    uint16_t *blend = pyramid_alloc(sizeof (uint16_t) * src_size);
+    int32_t x, y, top, bottom, fy;
+
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *row = image_row(dst, y);
+
+        bilinear_position(y, dst->height, src->height, &top, &bottom, &fy);
+        asm_bilinear_col_sse2(image_row(src, top), image_row(src, bottom),
+                              blend, src_size, fy);
+        for (x = 0; x < size; ++x) {
+            const int32_t fx = args->x_weight[x];
+            const uint32_t sum = blend[args->x_left[x]] *
+                                 (BILINEAR_ONE - fx) +
+                                 blend[args->x_right[x]] * fx;
+
+            row[x] = (sum + (1 << (2 * BILINEAR_SHIFT - 1))) >>
+                     (2 * BILINEAR_SHIFT);
+        }
+    }
+    free(blend);
+}
+
+image_container *resize_bilinear(const image_container *img,
+                                 int32_t width, int32_t height)
+{
+    const int32_t comp = img->comp;
+    pyramid_args args = { .src = img };
+    int32_t *x_left = pyramid_alloc(3 * sizeof (int32_t) * width * comp);
+    int32_t *x_right = x_left + width * comp;
+    int32_t *x_weight = x_right + width * comp;
+    int32_t x, c, left, right, weight;
+
+    /* The columns are the same for every row */
+    for (x = 0; x < width; ++x) {
+        bilinear_position(x, width, img->width, &left, &right, &weight);
+        for (c = 0; c < comp; ++c) {
+            x_left[x * comp + c] = left * comp + c;
+            x_right[x * comp + c] = right * comp + c;
+            x_weight[x * comp + c] = weight;
+        }
+    }
+
+    args.dst = allocate_container(width, height, comp);
+    args.x_left = x_left;
+    args.x_right = x_right;
+    args.x_weight = x_weight;
+    thread_pool_run(bilinear_band, &args, height,
+                    thread_pool_band_rows(3 * (size_t)width * comp, 0));
+    free(x_left);
+    return args.dst;
+}
+
+image_container *downscale(const image_container *img,
+                           int32_t width, int32_t height)
+{
+    const image_container *current = img;
+    image_container *next;
+
+    while (current->width >= 2 * width && current->height >= 2 * height) {
+        next = downscale2(current);
+        if (current != img) {
+            free_container((image_container *)current);
+        }
+        current = next;
+    }
+    if (current != img && current->width == width &&
+        current->height == height) {
+        return (image_container *)current;
+    }
+
+    next = resize_bilinear(current, width, height);
+    if (current != img) {
+        free_container((image_container *)current);
+    }
+    return next;
+}
+
+/* Horizontal pass of the reduction : the binomial sum around every even
+ * pixel of the row, 16 times the pixel */
+static void reduce_row(const uint8_t *src, uint16_t *dst, int32_t width,
+                       int32_t dst_width, int32_t comp)
+{
+    int32_t x, c, i, sx;
+
+    for (x = 0; x < dst_width; ++x) {
+        sx = 2 * x - PYRAMID_TAPS / 2;
+        for (c = 0; c < comp; ++c) {
+            uint16_t sum = 0;
+
+            if (sx >= 0 && sx + PYRAMID_TAPS <= width) {
+                const uint8_t *s = src + sx * comp + c;
+
+                sum = s[0] + 4 * s[comp] + 6 * s[2 * comp] +
+                      4 * s[3 * comp] + s[4 * comp];
+            } else {
+                for (i = 0; i < PYRAMID_TAPS; ++i) {
+                    sum += binomial[i] *
+                           src[clamp_index(sx + i, width) * comp + c];
+                }
+            }
+            dst[x * comp + c] = sum;
+        }
+    }
+}
+
+/* The horizontal sums of the source rows are kept in a ring, each row
+ * is used by 2 or 3 rows of dst. The vertical sums run on vectors */
+static void reduce_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    pyramid_args *args = arg;
+    const image_container *src = args->src;
+    image_container *dst = args->dst;
+    const int32_t size = dst->width * dst->comp;
+    uint16_t *ring = pyramid_alloc(PYRAMID_TAPS * sizeof (uint16_t) * size);
+    const uint16_t *rows[PYRAMID_TAPS];
+    int32_t tags[PYRAMID_TAPS];
+    int32_t y, j, sy, slot;
+
+    for (j = 0; j < PYRAMID_TAPS; ++j) {
+        tags[j] = -1;
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *row = image_row(dst, y);
+
+        /* PYRAMID_TAPS consecutive rows never share a slot */
+        for (j = 0; j < PYRAMID_TAPS; ++j) {
+            sy = clamp_index(2 * y + j - PYRAMID_TAPS / 2, src->height);
+            slot = sy % PYRAMID_TAPS;
+            if (tags[slot] != sy) {
+                reduce_row(image_row(src, sy), ring + slot * size,
+                           src->width, dst->width, src->comp);
+                tags[slot] = sy;
+            }
+            rows[j] = ring + slot * size;
+        }
+        asm_reduce_col_sse2(rows, row, size);
+    }
+    free(ring);
+}
+
+image_container *pyramid_reduce(const image_container *img)
+{
+    pyramid_args args = { .src = img };
+
+    args.dst = allocate_container((img->width + 1) / 2,
+                                  (img->height + 1) / 2, img->comp);
+    thread_pool_run(reduce_band, &args, args.dst->height,
+                    thread_pool_band_rows(3 * (size_t)img->width *
+                                          img->comp, PYRAMID_TAPS / 2));
+    return args.dst;
+}
+
+/* Horizontal pass of the expansion, 8 times the pixel : the even pixels
+ * are (1 6 1) around the source pixel, the odd ones (4 4) between two */
+static void expand_row(const uint8_t *src, uint16_t *dst, int32_t width,
+                       int32_t dst_width, int32_t comp)
+{
+    int32_t x, c, m, prev, next;
+
+    for (x = 0; x < dst_width; ++x) {
+        m = x / 2;
+        prev = clamp_index(m - 1, width) * comp;
+        next = clamp_index(m + 1, width) * comp;
+        for (c = 0; c < comp; ++c) {
+            if (x & 1) {
+                dst[x * comp + c] = 4 * (src[m * comp + c] + src[next + c]);
+            } else {
+                dst[x * comp + c] = src[prev + c] + 6 * src[m * comp + c] +
+                                    src[next + c];
+            }
+        }
+    }
+}
+
+static void expand_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    pyramid_args *args = arg;
+    const image_container *src = args->src;
+    image_container *dst = args->dst;
+    const int32_t size = dst->width * dst->comp;
+    uint16_t *ring = pyramid_alloc(EXPAND_TAPS * sizeof (uint16_t) * size);
+    const uint16_t *rows[EXPAND_TAPS];
+    int32_t tags[EXPAND_TAPS];
+    int32_t y, j, sy, slot;
+
+    for (j = 0; j < EXPAND_TAPS; ++j) {
+        tags[j] = -1;
+    }
+
+    for (y = y_start; y < y_end; ++y) {
+        uint8_t *row = image_row(dst, y);
+
+        for (j = 0; j < EXPAND_TAPS; ++j) {
+            sy = clamp_index(y / 2 + j - 1, src->height);
+            slot = sy % EXPAND_TAPS;
+            if (tags[slot] != sy) {
+                expand_row(image_row(src, sy), ring + slot * size,
+                           src->width, dst->width, src->comp);
+                tags[slot] = sy;
+            }
+            rows[j] = ring + slot * size;
+        }
+        asm_expand_col_sse2(rows, row, size, y & 1);
+    }
+    free(ring);
+}
+
+image_container *pyramid_expand(const image_container *img,
+                                int32_t width, int32_t height)
+{
+    pyramid_args args = { .src = img };
+
+    args.dst = allocate_container(width, height, img->comp);
+    thread_pool_run(expand_band, &args, height,
+                    thread_pool_band_rows(3 * (size_t)width * img->comp,
+                                          EXPAND_TAPS / 2));
+    return args.dst;
+}
+
+void pyramid_gaussian(image_pyramid *pyr, const image_container *img,
+                      int32_t nb_levels)
+{
+    image_container *level;
+
+    if (nb_levels > PYRAMID_MAX_LEVELS) {
+        nb_levels = PYRAMID_MAX_LEVELS;
+    }
+    level = allocate_container(img->width, img->height, img->comp);
+    copy_container_rows(level, img);
+    pyr->level[0] = level;
+    pyr->nb_levels = 1;
+
+    while (pyr->nb_levels < nb_levels && level->width > 1 &&
+           level->height > 1) {
+        level = pyramid_reduce(level);
+        pyr->level[pyr->nb_levels++] = level;
+    }
+}
+
+void pyramid_laplacian(image_pyramid *lap, const image_pyramid *gauss)
+{
+    const image_container *last = gauss->level[gauss->nb_levels - 1];
+    image_container *expanded, *level;
+    const image_container *g;
+    int32_t l, x, y, size, value;
+
+    for (l = 0; l < gauss->nb_levels - 1; ++l) {
+        g = gauss->level[l];
+        size = g->width * g->comp;
+        expanded = pyramid_expand(gauss->level[l + 1], g->width, g->height);
+        level = allocate_container(g->width, g->height, g->comp);
+        for (y = 0; y < g->height; ++y) {
+            const uint8_t *g_row = image_row(g, y);
+            const uint8_t *e_row = image_row(expanded, y);
+            uint8_t *row = image_row(level, y);
+
+            for (x = 0; x < size; ++x) {
+                value = g_row[x] - e_row[x] + PYRAMID_LAPLACIAN_BIAS;
+                row[x] = value < 0 ? 0 : value > UINT8_MAX ? UINT8_MAX :
+                         value;
+            }
+        }
+        free_container(expanded);
+        lap->level[l] = level;
+    }
+
+    level = allocate_container(last->width, last->height, last->comp);
+    copy_container_rows(level, last);
+    lap->level[l] = level;
+    lap->nb_levels = gauss->nb_levels;
+}
+
+void pyramid_free(image_pyramid *pyr)
+{
+    int32_t l;
+
+    for (l = 0; l < pyr->nb_levels; ++l) {
+        free_container(pyr->level[l]);
+    }
+    pyr->nb_levels = 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * File      : pyramid.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Downscaling (2x box with SIMD, bilinear to any smaller size) and the
+ * Gaussian and Laplacian pyramids built on it, so the expensive filters
+ * can run on small levels first. All on the thread pool, for any number
+ * of components.
+ */
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image_processing.h"
+
+#define PYRAMID_MAX_LEVELS 16
+/* Added to the differences of the Laplacian levels, which are then
+ * saturated to [0, 255] so they can be saved as images */
+#define PYRAMID_LAPLACIAN_BIAS 128
+
+/* Level 0 is the size of the image, each level is half of the previous
+ * one (rounded up) */
+typedef struct {
+    int32_t nb_levels;
+    image_container *level[PYRAMID_MAX_LEVELS];
+} image_pyramid;
+
+/* Reads widthxheight. Returns false when it is not valid */
+bool pyramid_size_parse(const char *arg, int32_t *width, int32_t *height);
+
+/* Half of the image, each pixel the mean of a 2x2 block. The last
+ * column and row of odd sizes are averaged with themselves */
+image_container *downscale2(const image_container *img);
+
+/* Bilinear interpolation at the centers of the pixels of the new size,
+ * for downscaling by less than 2 */
+image_container *resize_bilinear(const image_container *img,
+                                 int32_t width, int32_t height);
+
+/* Any smaller size : 2x box steps while the image is at least twice the
+ * size, then bilinear for the rest */
+image_container *downscale(const image_container *img,
+                           int32_t width, int32_t height);
+
+/* Next level of a Gaussian pyramid : 5x5 binomial blur (1 4 6 4 1) of
+ * the even pixels, the border pixels are clamped */
+image_container *pyramid_reduce(const image_container *img);
+
+/* Image of width x height from the next level (the inverse of
+ * pyramid_reduce() for the sizes) */
+image_container *pyramid_expand(const image_container *img,
+                                int32_t width, int32_t height);
+
+/* Gaussian pyramid of at most nb_levels levels, level 0 a copy of img.
+ * Stops when a side is 1 pixel */
+void pyramid_gaussian(image_pyramid *pyr, const image_container *img,
+                      int32_t nb_levels);
+
+/* Laplacian pyramid of a Gaussian one : each level minus the expansion
+ * of the next one, the last level is the last Gaussian level */
+void pyramid_laplacian(image_pyramid *lap, const image_pyramid *gauss);
+
+void pyramid_free(image_pyramid *pyr);
+
+#endif /* __PYRAMID_H__ */
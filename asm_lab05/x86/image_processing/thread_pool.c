@@ -0,0 +1,210 @@
+/*
+ * File      : thread_pool.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _GNU_SOURCE /* sysconf L2 cache size */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+static struct {
+    pthread_t threads[MAX_THREADS];
+    int nb_workers;          /* Threads besides the caller */
+    bool started;
+    bool stop;
+
+    pthread_mutex_t run_lock;  /* One job at a time */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;  /* A new job is available */
+    pthread_cond_t done_cond;  /* All workers are done with the job */
+    unsigned generation;       /* Incremented for each job */
+    int busy;                  /* Workers still on the current job */
+
+    /* Current job */
+    band_function func;
+    void *arg;
+    int32_t height;
+    int32_t band_rows;
+    int32_t next_band;         /* Next band to be taken (atomic) */
+} pool = {
+    .run_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Takes bands of the current job until there are none left */
+static void process_bands(void)
+{
+    int64_t y_start, y_end;
+
+    for (;;) {
+        y_start = (int64_t)__atomic_fetch_add(&pool.next_band, 1,
+                                              __ATOMIC_RELAXED) *
+                  pool.band_rows;
+        if (y_start >= pool.height) {
+            return;
+        }
+        y_end = y_start + pool.band_rows;
+        if (y_end > pool.height) {
+            y_end = pool.height;
+        }
+        pool.func(pool.arg, y_start, y_end);
+    }
+}
+
+static void *worker(void *unused)
+{
+    unsigned seen = 0;
+
+    (void)unused;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (!pool.stop && pool.generation == seen) {
+            pthread_cond_wait(&pool.work_cond, &pool.lock);
+        }
+        if (pool.stop) {
+            break;
+        }
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        process_bands();
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+void thread_pool_init(int nb_threads)
+{
+    if (pool.started) {
+        return;
+    }
+
+    if (nb_threads <= 0) {
+        nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (nb_threads <= 0) {
+        nb_threads = 1;
+    }
+    if (nb_threads > MAX_THREADS) {
+        nb_threads = MAX_THREADS;
+    }
+
+    pool.stop = false;
+    pool.generation = 0;
+    pool.nb_workers = 0;
+    for (int i = 0; i < nb_threads - 1; ++i) {
+        if (pthread_create(&pool.threads[i], NULL, worker, NULL)) {
+            fprintf(stderr, "[%s] thread creation failed\n", __func__);
+            break;
+        }
+        pool.nb_workers++;
+    }
+    pool.started = true;
+}
+
+void thread_pool_run(band_function func, void *arg,
+                     int32_t height, int32_t band_rows)
+{
+    if (height <= 0) {
+        return;
+    }
+    if (band_rows <= 0) {
+        band_rows = 1;
+    }
+    if (!pool.started) {
+        thread_pool_init(0);
+    }
+
+    pthread_mutex_lock(&pool.run_lock);
+
+    /* Publish the job */
+    pthread_mutex_lock(&pool.lock);
+    pool.func = func;
+    pool.arg = arg;
+    pool.height = height;
+    pool.band_rows = band_rows;
+    pool.next_band = 0;
+    pool.busy = pool.nb_workers;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    /* Work with the others */
+    process_bands();
+
+    /* Wait for the last bands */
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy) {
+        pthread_cond_wait(&pool.done_cond, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.run_lock);
+}
+
+int32_t thread_pool_band_rows(size_t bytes_per_row, int32_t halo_rows)
+{
+    long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    int64_t rows;
+
+    if (l2_size <= 0) {
+        l2_size = DEFAULT_L2_CACHE_SIZE;
+    }
+    if (bytes_per_row == 0) {
+        bytes_per_row = 1;
+    }
+
+    /* Keep the other half of the cache for the next band and the code */
+    rows = (int64_t)(l2_size / 2) / bytes_per_row - 2 * halo_rows;
+    if (rows < 1) {
+        rows = 1;
+    }
+    if (rows > INT32_MAX) {
+        rows = INT32_MAX;
+    }
+
+    return rows;
+}
+
+int thread_pool_size(void)
+{
+    return pool.started ? pool.nb_workers + 1 : 0;
+}
+
+void thread_pool_destroy(void)
+{
+    if (!pool.started) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.nb_workers; ++i) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pool.nb_workers = 0;
+    pool.started = false;
+}
@@ -0,0 +1,46 @@
+/*
+ * File      : thread_pool.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Persistent pool of worker threads that process an image by bands of
+ * rows. The pool is created once and reused for every pipeline stage and
+ * every image of the process.
+ */
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size assumed for the L2 cache when it cannot be queried */
+#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
+/* Maximum number of threads in the pool */
+#define MAX_THREADS 64
+
+/* Processes the rows [y_start, y_end[ of an image */
+typedef void (*band_function)(void *arg, int32_t y_start, int32_t y_end);
+
+/* Starts the pool, nb_threads = 0 uses one thread per online CPU.
+ * Calling it again without thread_pool_destroy() does nothing */
+void thread_pool_init(int nb_threads);
+
+/* Calls func on bands of band_rows rows until the height rows are done.
+ * The calling thread takes part and the call returns once all bands are
+ * done. Bands are handed out one at a time so fast threads take more.
+ * It must not be called from a band function */
+void thread_pool_run(band_function func, void *arg,
+                     int32_t height, int32_t band_rows);
+
+/* Number of rows per band so that the rows touched by a band, with
+ * halo_rows rows above and below it, stay in half of the L2 cache */
+int32_t thread_pool_band_rows(size_t bytes_per_row, int32_t halo_rows);
+
+/* Number of threads working in the pool (including the caller) */
+int thread_pool_size(void);
+
+/* Stops and joins the workers */
+void thread_pool_destroy(void);
+
+#endif /* __THREAD_POOL_H__ */
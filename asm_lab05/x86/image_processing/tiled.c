@@ -0,0 +1,380 @@
+/*
+ * File      : tiled.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _DEFAULT_SOURCE      /* pread(), pwrite() and ftruncate() */
+#define _FILE_OFFSET_BITS 64 /* Files over 2 GiB in 32 bits */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "convolution.h"
+#include "pnm.h"
+#include "thread_pool.h"
+#include "tiled.h"
+
+#define TILED_HEADER_SIZE 1024 /* Read to find the pixels of a PGM */
+#define TILED_MAX_VALUE   255
+
+typedef struct {
+    image_container *region;   /* Source pixels of a tile and its halo */
+    image_container *filtered; /* Result, same place as the region */
+    const conv_kernel *kernel;
+    int32_t top;               /* First row of the tile in the region */
+} tiled_args;
+
+static void *tiled_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/* Reads a number of the header at *pos, after spaces and comments */
+static bool header_number(const char *header, size_t size, size_t *pos,
+                          int64_t *value)
+{
+    while (*pos < size) {
+        if (header[*pos] == '#') {
+            while (*pos < size && header[*pos] != '\n') {
+                ++*pos;
+            }
+        } else if (isspace((unsigned char)header[*pos])) {
+            ++*pos;
+        } else {
+            break;
+        }
+    }
+    if (*pos == size || !isdigit((unsigned char)header[*pos])) {
+        return false;
+    }
+
+    *value = 0;
+    while (*pos < size && isdigit((unsigned char)header[*pos])) {
+        if (*value > (INT64_MAX - 9) / 10) {
+            return false;
+        }
+        *value = *value * 10 + header[(*pos)++] - '0';
+    }
+    return true;
+}
+
+static tiled_image *tiled_init(int fd, int64_t width, int64_t height,
+                               int64_t offset, int32_t cache_tiles)
+{
+    tiled_image *img = tiled_alloc(sizeof (tiled_image));
+    int32_t s;
+
+    if (cache_tiles < TILED_MIN_CACHE) {
+        cache_tiles = TILED_MIN_CACHE;
+    }
+    img->fd = fd;
+    img->width = width;
+    img->height = height;
+    img->offset = offset;
+    img->nb_slots = cache_tiles;
+    img->slots = tiled_alloc(cache_tiles * sizeof (tile_slot));
+    img->clock = 0;
+    img->reads = 0;
+    img->writes = 0;
+    for (s = 0; s < cache_tiles; ++s) {
+        img->slots[s].tx = -1;
+        img->slots[s].ty = -1;
+        img->slots[s].data = tiled_alloc((size_t)TILE_SIZE * TILE_SIZE);
+        img->slots[s].dirty = false;
+        img->slots[s].last_use = 0;
+    }
+    return img;
+}
+
+tiled_image *tiled_open(const char *path, const char *raw_size,
+                        int32_t cache_tiles)
+{
+    char header[TILED_HEADER_SIZE], end;
+    int64_t width, height, max_value, offset = 0;
+    size_t pos = 2;
+    ssize_t size;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "[%s] open error (%s)\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    if (pnm_format(path) == PNM_RAW) {
+        if (!raw_size || sscanf(raw_size, "%" SCNd64 "x%" SCNd64 "%c",
+                                &width, &height, &end) != 2 ||
+            width <= 0 || height <= 0) {
+            fprintf(stderr, "[%s] the size of %s is needed (-R "
+                    "widthxheight)\n", __func__, path);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        size = pread(fd, header, sizeof (header), 0);
+        if (size < 3 || header[0] != 'P' || header[1] != '5' ||
+            !header_number(header, size, &pos, &width) ||
+            !header_number(header, size, &pos, &height) ||
+            !header_number(header, size, &pos, &max_value) ||
+            pos == (size_t)size || !isspace((unsigned char)header[pos++]) ||
+            !width || !height || max_value != TILED_MAX_VALUE) {
+            fprintf(stderr, "[%s] %s is not a binary 8 bits PGM (max "
+                    "value 255)\n", __func__, path);
+            exit(EXIT_FAILURE);
+        }
+        offset = pos;
+    }
+
+    if ((st.st_size - offset) / width < height) {
+        fprintf(stderr, "[%s] %s is too short for %" PRId64 "x%" PRId64
+                "\n", __func__, path, width, height);
+        exit(EXIT_FAILURE);
+    }
+    return tiled_init(fd, width, height, offset, cache_tiles);
+}
+
+tiled_image *tiled_create(const char *path, int64_t width, int64_t height,
+                          int32_t cache_tiles)
+{
+    char header[TILED_HEADER_SIZE];
+    int header_size = 0;
+    int fd;
+
+    if (pnm_format(path) == PNM_NONE) {
+        fprintf(stderr, "[%s] the tiled result %s is not a .pgm or .raw "
+                "file\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+    if (pnm_format(path) != PNM_RAW) {
+        header_size = snprintf(header, sizeof (header),
+                               "P5\n%" PRId64 " %" PRId64 "\n%d\n",
+                               width, height, TILED_MAX_VALUE);
+    }
+
+    /* The pixels are a hole until their tile is written */
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 ||
+        pwrite(fd, header, header_size, 0) != header_size ||
+        ftruncate(fd, header_size + width * height)) {
+        fprintf(stderr, "[%s] cannot create %s\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return tiled_init(fd, width, height, header_size, cache_tiles);
+}
+
+/* Reads or writes the rows of a tile, the tiles of the last column and
+ * row may be smaller */
+static void tile_io(tiled_image *img, tile_slot *slot, bool write)
+{
+    const int64_t x = slot->tx * TILE_SIZE;
+    const int64_t y = slot->ty * TILE_SIZE;
+    const size_t width = img->width - x < TILE_SIZE ? img->width - x :
+                         TILE_SIZE;
+    const int32_t height = img->height - y < TILE_SIZE ? img->height - y :
+                           TILE_SIZE;
+    ssize_t done;
+    int32_t r;
+
+    for (r = 0; r < height; ++r) {
+        uint8_t *row = slot->data + (size_t)r * TILE_SIZE;
+        const off_t offset = img->offset + (y + r) * img->width + x;
+
+        done = write ? pwrite(img->fd, row, width, offset) :
+                       pread(img->fd, row, width, offset);
+        if (done != (ssize_t)width) {
+            fprintf(stderr, "[%s] %s error\n", __func__,
+                    write ? "write" : "read");
+            perror(__func__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (write) {
+        ++img->writes;
+    } else {
+        ++img->reads;
+    }
+}
+
+uint8_t *tiled_tile(tiled_image *img, int64_t tx, int64_t ty,
+                    bool overwrite)
+{
+    tile_slot *slot = NULL;
+    int32_t s;
+
+    /* The tile or the least recently used slot */
+    for (s = 0; s < img->nb_slots; ++s) {
+        tile_slot *candidate = &img->slots[s];
+
+        if (candidate->tx == tx && candidate->ty == ty) {
+            slot = candidate;
+            break;
+        }
+        if (!slot || candidate->last_use < slot->last_use) {
+            slot = candidate;
+        }
+    }
+
+    if (slot->tx != tx || slot->ty != ty) {
+        if (slot->dirty) {
+            tile_io(img, slot, true);
+        }
+        slot->tx = tx;
+        slot->ty = ty;
+        slot->dirty = false;
+        if (!overwrite) {
+            tile_io(img, slot, false);
+        }
+    }
+    slot->dirty |= overwrite;
+    slot->last_use = ++img->clock;
+    return slot->data;
+}
+
+void tiled_close(tiled_image *img)
+{
+    int32_t s;
+
+    for (s = 0; s < img->nb_slots; ++s) {
+        if (img->slots[s].dirty) {
+            tile_io(img, &img->slots[s], true);
+        }
+        free(img->slots[s].data);
+    }
+    if (close(img->fd)) {
+        fprintf(stderr, "[%s] close error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    free(img->slots);
+    free(img);
+}
+
+/* Copies the pixels [x0, x1[ x [y0, y1[ of the image to the region, from
+ * the tiles they are in */
+static void tiled_read_region(tiled_image *img, image_container *region,
+                              int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    int64_t tx, ty, x, y, xe, ye;
+    const uint8_t *tile;
+
+    region->width = x1 - x0;
+    region->height = y1 - y0;
+    for (ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty) {
+        for (tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx) {
+            tile = tiled_tile(img, tx, ty, false);
+            x = tx * TILE_SIZE > x0 ? tx * TILE_SIZE : x0;
+            xe = (tx + 1) * TILE_SIZE < x1 ? (tx + 1) * TILE_SIZE : x1;
+            y = ty * TILE_SIZE > y0 ? ty * TILE_SIZE : y0;
+            ye = (ty + 1) * TILE_SIZE < y1 ? (ty + 1) * TILE_SIZE : y1;
+            for (; y < ye; ++y) {
+                memcpy(image_row(region, y - y0) + (x - x0),
+                       tile + (size_t)(y - ty * TILE_SIZE) * TILE_SIZE +
+                       (x - tx * TILE_SIZE), xe - x);
+            }
+        }
+    }
+}
+
+static void tiled_band(void *arg, int32_t y_start, int32_t y_end)
+{
+    tiled_args *args = arg;
+    const conv_border border = { BORDER_COPY, 0 };
+
+    conv_rows(args->region, args->filtered, args->kernel, &border,
+              args->top + y_start, args->top + y_end);
+}
+
+/* The region of a tile has its halo of radius pixels, except on the
+ * edges of the image. The pixels of the tile are then never closer than
+ * radius to the edges of the region, unless they are to the edges of
+ * the image, where the copy border of conv_rows() is the right one */
+void tiled_filter(const char *src_path, const char *dest_path,
+                  const char *raw_size, const conv_kernel *kernel,
+                  int32_t cache_tiles)
+{
+    const int32_t radius = kernel->size / 2;
+    const int32_t region_stride = TILE_SIZE + 2 * radius;
+    const size_t region_size = (size_t)region_stride * region_stride;
+    conv_kernel separated = *kernel;
+    image_container region = { .comp = COMPONENT_GRAYSCALE };
+    image_container filtered = { .comp = COMPONENT_GRAYSCALE };
+    tiled_args args = {
+        .region = &region, .filtered = &filtered, .kernel = &separated
+    };
+    tiled_image *src, *dst;
+    int64_t tx, ty, x0, y0, x1, y1, nb_tx, nb_ty;
+    int32_t width, height, left, r;
+    uint8_t *tile;
+
+    kernel_separate(&separated);
+    src = tiled_open(src_path, raw_size, cache_tiles);
+    dst = tiled_create(dest_path, src->width, src->height, cache_tiles);
+    /* The regions of the tiles of the edges are narrower, the buffers
+     * keep the stride of the widest ones */
+    region.stride = filtered.stride = region_stride;
+    region.data = tiled_alloc(region_size);
+    filtered.data = tiled_alloc(region_size);
+
+    nb_tx = (src->width + TILE_SIZE - 1) / TILE_SIZE;
+    nb_ty = (src->height + TILE_SIZE - 1) / TILE_SIZE;
+    for (ty = 0; ty < nb_ty; ++ty) {
+        for (tx = 0; tx < nb_tx; ++tx) {
+            width = src->width - tx * TILE_SIZE < TILE_SIZE ?
+                    src->width - tx * TILE_SIZE : TILE_SIZE;
+            height = src->height - ty * TILE_SIZE < TILE_SIZE ?
+                     src->height - ty * TILE_SIZE : TILE_SIZE;
+            x0 = tx * TILE_SIZE - radius > 0 ? tx * TILE_SIZE - radius : 0;
+            y0 = ty * TILE_SIZE - radius > 0 ? ty * TILE_SIZE - radius : 0;
+            x1 = tx * TILE_SIZE + width + radius < src->width ?
+                 tx * TILE_SIZE + width + radius : src->width;
+            y1 = ty * TILE_SIZE + height + radius < src->height ?
+                 ty * TILE_SIZE + height + radius : src->height;
+
+            tiled_read_region(src, &region, x0, y0, x1, y1);
+            filtered.width = region.width;
+            filtered.height = region.height;
+            args.top = ty * TILE_SIZE - y0;
+            thread_pool_run(tiled_band, &args, height,
+                            thread_pool_band_rows(2 * (size_t)region.width,
+                                                  radius));
+
+            left = tx * TILE_SIZE - x0;
+            tile = tiled_tile(dst, tx, ty, true);
+            for (r = 0; r < height; ++r) {
+                memcpy(tile + (size_t)r * TILE_SIZE,
+                       image_row(&filtered, args.top + r) + left, width);
+            }
+        }
+    }
+
+    fprintf(stdout, "[%s] %s filtered to %s (%" PRId64 "x%" PRId64
+            ", %" PRId64 " tiles, %" PRIu64 " tiles read)\n", __func__,
+            src_path, dest_path, src->width, src->height, nb_tx * nb_ty,
+            src->reads);
+
+    free(region.data);
+    free(filtered.data);
+    tiled_close(src);
+    tiled_close(dst);
+}
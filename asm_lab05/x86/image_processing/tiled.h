@@ -0,0 +1,71 @@
+/*
+ * File      : tiled.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Out of core grayscale images : a binary PGM or raw file is read and
+ * written by square tiles through a cache of a bounded number of tiles,
+ * so the image may be larger than the memory (and than the 4 GiB a 32
+ * bits process can address). The sizes are 64 bits.
+ */
+
+#ifndef __TILED_H__
+#define __TILED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "kernels.h"
+
+/* Side of the tiles in pixels */
+#define TILE_SIZE 512
+/* Tiles kept in memory by default, 16 MiB */
+#define TILED_DEFAULT_CACHE 64
+/* Below this, a tile and its neighbours would not stay in the cache */
+#define TILED_MIN_CACHE 4
+
+typedef struct {
+    int64_t tx;        /* Column of the tile, -1 : slot empty */
+    int64_t ty;        /* Row of the tile */
+    uint8_t *data;     /* TILE_SIZE x TILE_SIZE pixels */
+    bool dirty;        /* To be written back to the file */
+    uint64_t last_use;
+} tile_slot;
+
+typedef struct {
+    int fd;
+    int64_t width;
+    int64_t height;
+    int64_t offset;    /* Of the pixels in the file, after the header */
+    int32_t nb_slots;
+    tile_slot *slots;
+    uint64_t clock;
+    uint64_t reads;    /* Tiles read from the file */
+    uint64_t writes;   /* Tiles written to the file */
+} tiled_image;
+
+/* Opens a binary grayscale PGM or a raw file of raw_size (widthxheight)
+ * pixels with a cache of cache_tiles tiles */
+tiled_image *tiled_open(const char *path, const char *raw_size,
+                        int32_t cache_tiles);
+
+/* Creates a PGM or raw file of width x height pixels to be written */
+tiled_image *tiled_create(const char *path, int64_t width, int64_t height,
+                          int32_t cache_tiles);
+
+/* Pixels of the tile tx, ty, with a stride of TILE_SIZE. The pointer is
+ * valid until the next call. With overwrite, the tile is not read from
+ * the file, the caller writes all of it and it is written back */
+uint8_t *tiled_tile(tiled_image *img, int64_t tx, int64_t ty,
+                    bool overwrite);
+
+/* Writes back the tiles written and closes the file */
+void tiled_close(tiled_image *img);
+
+/* Convolution of the image of src_path into dest_path with the copy
+ * border, tile by tile. The rows of a tile run on the thread pool */
+void tiled_filter(const char *src_path, const char *dest_path,
+                  const char *raw_size, const conv_kernel *kernel,
+                  int32_t cache_tiles);
+
+#endif /* __TILED_H__ */
@@ -0,0 +1,145 @@
+/*
+ * File      : trace.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _DEFAULT_SOURCE /* clock_gettime() */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "trace.h"
+
+bool trace_enabled = false;
+
+static struct {
+    FILE *file;
+    int format;
+    bool first;            /* No event written yet */
+    struct timespec origin;
+    pthread_mutex_t lock;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static double seconds_since(clockid_t clock, const struct timespec *origin)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (ts.tv_sec - origin->tv_sec) +
+           (ts.tv_nsec - origin->tv_nsec) * 1e-9;
+}
+
+void trace_open(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    /* Only the last -j is kept */
+    trace_close();
+    trace.file = fopen(path, "w");
+    if (!trace.file) {
+        fprintf(stderr, "[%s] fopen error (%s)\n", __func__, path);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    trace.format = ext && !strcmp(ext, ".json") ? TRACE_CHROME :
+                   TRACE_JSON_LINES;
+    trace.first = true;
+    clock_gettime(CLOCK_MONOTONIC, &trace.origin);
+    if (trace.format == TRACE_CHROME) {
+        fputs("[\n", trace.file);
+    }
+    trace_enabled = true;
+
+    /* The stages may end the process with exit() */
+    atexit(trace_close);
+}
+
+void trace_close(void)
+{
+    if (!trace_enabled) {
+        return;
+    }
+    trace_enabled = false;
+    if (trace.format == TRACE_CHROME) {
+        fputs("\n]\n", trace.file);
+    }
+    if (fclose(trace.file)) {
+        fprintf(stderr, "[%s] write error\n", __func__);
+        perror(__func__);
+    }
+}
+
+void trace_span_begin(trace_span *span, const char *name)
+{
+    const struct timespec zero = { 0, 0 };
+
+    span->name = name;
+    pthread_mutex_lock(&trace.lock);
+    span->allocs = trace.allocs;
+    span->alloc_bytes = trace.alloc_bytes;
+    pthread_mutex_unlock(&trace.lock);
+    span->cpu_start = seconds_since(CLOCK_PROCESS_CPUTIME_ID, &zero);
+    span->start = seconds_since(CLOCK_MONOTONIC, &trace.origin);
+    span->tsc = __rdtsc();
+}
+
+void trace_span_end(trace_span *span, uint64_t bytes)
+{
+    const struct timespec zero = { 0, 0 };
+    const uint64_t cycles = __rdtsc() - span->tsc;
+    const double wall = seconds_since(CLOCK_MONOTONIC, &trace.origin) -
+                        span->start;
+    const double cpu = seconds_since(CLOCK_PROCESS_CPUTIME_ID, &zero) -
+                       span->cpu_start;
+    uint64_t allocs, alloc_bytes;
+
+    pthread_mutex_lock(&trace.lock);
+    allocs = trace.allocs - span->allocs;
+    alloc_bytes = trace.alloc_bytes - span->alloc_bytes;
+
+    if (trace.format == TRACE_CHROME) {
+        /* Complete events, the times are in microseconds */
+        fprintf(trace.file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                "\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{"
+                "\"cpu_us\":%.3f,\"cycles\":%llu,\"bytes\":%llu,"
+                "\"allocs\":%llu,\"alloc_bytes\":%llu}}",
+                trace.first ? "" : ",\n", span->name, (int)getpid(),
+                span->start * 1e6, wall * 1e6, cpu * 1e6,
+                (unsigned long long)cycles, (unsigned long long)bytes,
+                (unsigned long long)allocs,
+                (unsigned long long)alloc_bytes);
+    } else {
+        fprintf(trace.file, "{\"stage\":\"%s\",\"start_us\":%.3f,"
+                "\"wall_us\":%.3f,\"cpu_us\":%.3f,\"cycles\":%llu,"
+                "\"bytes\":%llu,\"allocs\":%llu,\"alloc_bytes\":%llu}\n",
+                span->name, span->start * 1e6, wall * 1e6, cpu * 1e6,
+                (unsigned long long)cycles, (unsigned long long)bytes,
+                (unsigned long long)allocs,
+                (unsigned long long)alloc_bytes);
+    }
+    trace.first = false;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_count_alloc(size_t size)
+{
+    pthread_mutex_lock(&trace.lock);
+    ++trace.allocs;
+    trace.alloc_bytes += size;
+    pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,71 @@
+/*
+ * File      : trace.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Timing and counters of the stages of image_processing (load, grayscale,
+ * filters, save, comparison), written to a file when the -j option is
+ * given. Each stage gives its wall time, the CPU time of the process
+ * (of all the threads, so a stage waiting on the disk has less CPU than
+ * wall time and a parallel one more), the TSC cycles, the bytes of pixels
+ * it reads and writes and the containers it allocates.
+ *
+ * A .json file is a Chrome trace (chrome://tracing or ui.perfetto.dev),
+ * any other name gets one JSON object per line. When tracing is off a
+ * stage costs a test of trace_enabled.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_JSON_LINES 0
+#define TRACE_CHROME     1
+
+/* A stage being timed, on the stack of the caller */
+typedef struct {
+    const char *name;
+    double start;         /* Seconds since trace_open() */
+    double cpu_start;     /* Seconds of CPU of the process */
+    uint64_t tsc;
+    uint64_t allocs;      /* Counters when the stage began */
+    uint64_t alloc_bytes;
+} trace_span;
+
+extern bool trace_enabled;
+
+/* Starts tracing to path, the file is completed at exit */
+void trace_open(const char *path);
+void trace_close(void);
+
+void trace_span_begin(trace_span *span, const char *name);
+/* Writes the event of the stage, bytes : pixels read and written */
+void trace_span_end(trace_span *span, uint64_t bytes);
+void trace_count_alloc(size_t size);
+
+static inline void trace_begin(trace_span *span, const char *name)
+{
+    if (trace_enabled) {
+        trace_span_begin(span, name);
+    }
+}
+
+static inline void trace_end(trace_span *span, uint64_t bytes)
+{
+    if (trace_enabled) {
+        trace_span_end(span, bytes);
+    }
+}
+
+/* An image buffer of size bytes was allocated */
+static inline void trace_alloc(size_t size)
+{
+    if (trace_enabled) {
+        trace_count_alloc(size);
+    }
+}
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,337 @@
+/*
+ * File      : video.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#define _DEFAULT_SOURCE /* clock_gettime() */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "video.h"
+
+static void *video_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void queue_init(frame_queue *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+static void queue_destroy(frame_queue *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+/* Waits while the queue is full */
+static void queue_push(frame_queue *queue, video_frame *frame)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == VIDEO_QUEUE_DEPTH) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->frames[(queue->head + queue->count) % VIDEO_QUEUE_DEPTH] = frame;
+    ++queue->count;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Waits while the queue is empty. Returns NULL once it is closed and
+ * empty */
+static video_frame *queue_pop(frame_queue *queue)
+{
+    video_frame *frame = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if (queue->count) {
+        frame = queue->frames[queue->head];
+        queue->head = (queue->head + 1) % VIDEO_QUEUE_DEPTH;
+        --queue->count;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return frame;
+}
+
+static void queue_close(frame_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void frame_free(video_frame *frame)
+{
+    free_container(frame->luma);
+    free(frame->chroma);
+    free(frame);
+}
+
+/* Bytes of the chroma planes of the Y4M colorspace, -1 : not supported
+ * (only 8 bits samples) */
+static int64_t y4m_chroma_size(const char *colorspace, int32_t width,
+                               int32_t height)
+{
+    const int64_t half_width = (width + 1) / 2;
+    const int64_t half_height = (height + 1) / 2;
+
+    if (!strncmp(colorspace, "420", 3) &&
+        (!colorspace[3] || !strcmp(colorspace + 3, "jpeg") ||
+         !strcmp(colorspace + 3, "paldv") ||
+         !strcmp(colorspace + 3, "mpeg2"))) {
+        return 2 * half_width * half_height;
+    }
+    if (!strcmp(colorspace, "422")) {
+        return 2 * half_width * height;
+    }
+    if (!strcmp(colorspace, "411")) {
+        return 2 * (int64_t)((width + 3) / 4) * height;
+    }
+    if (!strcmp(colorspace, "444")) {
+        return 2 * (int64_t)width * height;
+    }
+    if (!strcmp(colorspace, "444alpha")) {
+        return 3 * (int64_t)width * height;
+    }
+    if (!strcmp(colorspace, "mono")) {
+        return 0;
+    }
+    return -1;
+}
+
+/* Reads the header line of a Y4M stream, which is copied to the output
+ * as it is */
+static void y4m_read_header(video_stream *vs)
+{
+    char line[Y4M_LINE_SIZE], colorspace[Y4M_LINE_SIZE] = "420jpeg";
+    char *token, *save;
+    int64_t chroma_size;
+
+    if (!fgets(line, sizeof (line), vs->in) || !strchr(line, '\n') ||
+        strncmp(line, Y4M_SIGNATURE " ", strlen(Y4M_SIGNATURE) + 1)) {
+        fprintf(stderr, "[%s] not a Y4M stream (or the raw size is "
+                "missing)\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    if (fputs(line, vs->out) == EOF) {
+        fprintf(stderr, "[%s] write error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+
+    vs->width = vs->height = 0;
+    *strchr(line, '\n') = '\0';
+    for (token = strtok_r(line + strlen(Y4M_SIGNATURE), " ", &save); token;
+         token = strtok_r(NULL, " ", &save)) {
+        if (token[0] == 'W') {
+            vs->width = atoi(token + 1);
+        } else if (token[0] == 'H') {
+            vs->height = atoi(token + 1);
+        } else if (token[0] == 'C') {
+            strcpy(colorspace, token + 1);
+        }
+    }
+
+    chroma_size = y4m_chroma_size(colorspace, vs->width, vs->height);
+    if (vs->width <= 0 || vs->height <= 0 || chroma_size < 0) {
+        fprintf(stderr, "[%s] unsupported stream (%dx%d, C%s)\n", __func__,
+                vs->width, vs->height, colorspace);
+        exit(EXIT_FAILURE);
+    }
+    vs->chroma_size = chroma_size;
+}
+
+/* Bytes of the luma read, its rows are padded in the container */
+static size_t read_luma(FILE *in, image_container *luma)
+{
+    size_t read = 0, row_read;
+    int32_t y;
+
+    for (y = 0; y < luma->height; ++y) {
+        row_read = fread(image_row(luma, y), 1, luma->width, in);
+        read += row_read;
+        if (row_read != (size_t)luma->width) {
+            break;
+        }
+    }
+    return read;
+}
+
+static bool write_luma(FILE *out, const image_container *luma)
+{
+    int32_t y;
+
+    for (y = 0; y < luma->height; ++y) {
+        if (fwrite(image_row(luma, y), 1, luma->width, out) !=
+            (size_t)luma->width) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Next frame of the input, NULL at the end */
+static video_frame *read_frame(video_stream *vs)
+{
+    char line[Y4M_LINE_SIZE];
+    const size_t luma_size = (size_t)vs->width * vs->height;
+    video_frame *frame;
+    size_t read;
+
+    if (vs->y4m) {
+        if (!fgets(line, sizeof (line), vs->in)) {
+            return NULL;
+        }
+        if (strncmp(line, Y4M_FRAME, strlen(Y4M_FRAME)) ||
+            !strchr(line, '\n')) {
+            fprintf(stderr, "[%s] frame header expected\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    frame = video_alloc(sizeof (video_frame));
+    frame->luma = allocate_container(vs->width, vs->height,
+                                     COMPONENT_GRAYSCALE);
+    frame->chroma = vs->chroma_size ? video_alloc(vs->chroma_size) : NULL;
+
+    read = read_luma(vs->in, frame->luma);
+    if (read == luma_size && frame->chroma) {
+        read += fread(frame->chroma, 1, vs->chroma_size, vs->in);
+    }
+    if (read == luma_size + vs->chroma_size) {
+        return frame;
+    }
+
+    frame_free(frame);
+    if (ferror(vs->in)) {
+        fprintf(stderr, "[%s] read error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    /* Nothing read is the end of a raw stream */
+    if (read || vs->y4m) {
+        fprintf(stderr, "[%s] last frame truncated, dropped\n", __func__);
+    }
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    video_stream *vs = arg;
+    video_frame *frame;
+
+    while ((frame = read_frame(vs))) {
+        queue_push(&vs->decoded, frame);
+    }
+    queue_close(&vs->decoded);
+    return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+    video_stream *vs = arg;
+    video_frame *frame;
+
+    while ((frame = queue_pop(&vs->filtered))) {
+        if ((vs->y4m && fputs(Y4M_FRAME "\n", vs->out) == EOF) ||
+            !write_luma(vs->out, frame->luma) ||
+            (frame->chroma && fwrite(frame->chroma, 1, vs->chroma_size,
+                                     vs->out) != vs->chroma_size) ||
+            fflush(vs->out)) {
+            fprintf(stderr, "[%s] write error\n", __func__);
+            perror(__func__);
+            exit(EXIT_FAILURE);
+        }
+        frame_free(frame);
+    }
+    return NULL;
+}
+
+int64_t video_filter(const raw_geometry *raw, frame_filter filter)
+{
+    video_stream vs = { .in = stdin, .out = stdout, .y4m = !raw };
+    pthread_t reader, writer;
+    struct timespec start, end;
+    video_frame *frame;
+    image_container *filtered;
+    int64_t frames = 0;
+    double seconds;
+
+    if (raw) {
+        if (raw->planes != COMPONENT_GRAYSCALE) {
+            fprintf(stderr, "[%s] raw frames are grayscale\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        vs.width = raw->width;
+        vs.height = raw->height;
+        vs.chroma_size = 0;
+    } else {
+        y4m_read_header(&vs);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    queue_init(&vs.decoded);
+    queue_init(&vs.filtered);
+    if (pthread_create(&reader, NULL, reader_thread, &vs) ||
+        pthread_create(&writer, NULL, writer_thread, &vs)) {
+        fprintf(stderr, "[%s] pthread_create failed\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The filter stage, between the reader and the writer */
+    while ((frame = queue_pop(&vs.decoded))) {
+        filtered = filter(frame->luma);
+        if (!filtered || filtered->width != frame->luma->width ||
+            filtered->height != frame->luma->height ||
+            filtered->comp != COMPONENT_GRAYSCALE) {
+            fprintf(stderr, "[%s] the filter changes the frames\n",
+                    __func__);
+            exit(EXIT_FAILURE);
+        }
+        free_container(frame->luma);
+        frame->luma = filtered;
+        queue_push(&vs.filtered, frame);
+        ++frames;
+    }
+    queue_close(&vs.filtered);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    queue_destroy(&vs.decoded);
+    queue_destroy(&vs.filtered);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* stdout is the video */
+    seconds = (end.tv_sec - start.tv_sec) +
+              (end.tv_nsec - start.tv_nsec) * 1e-9;
+    fprintf(stderr, "[%s] %lld frames of %dx%d, %.1f frames/s\n", __func__,
+            (long long)frames, vs.width, vs.height,
+            seconds > 0 ? frames / seconds : 0.0);
+    return frames;
+}
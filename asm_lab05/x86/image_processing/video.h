@@ -0,0 +1,68 @@
+/*
+ * File      : video.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Frames of a video filtered from stdin to stdout, so the program can
+ * sit in a pipe (ffmpeg ... -f yuv4mpegpipe - | image_processing -V |
+ * ffmpeg -i - ...). The frames are Y4M, the filter runs on the luma and
+ * the chroma planes are copied, or raw grayscale frames of a given size.
+ * Reading, filtering and writing are three threads linked by bounded
+ * queues, so the three stages overlap.
+ */
+
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "image_processing.h"
+#include "pnm.h"
+
+/* Frames waiting between two stages */
+#define VIDEO_QUEUE_DEPTH 4
+#define Y4M_SIGNATURE "YUV4MPEG2"
+#define Y4M_FRAME "FRAME"
+/* Longest header line of the stream or of a frame */
+#define Y4M_LINE_SIZE 1024
+
+typedef struct {
+    image_container *luma;
+    uint8_t *chroma;   /* Planes after the luma, NULL : none */
+} video_frame;
+
+/* Bounded queue of frames between two threads */
+typedef struct {
+    video_frame *frames[VIDEO_QUEUE_DEPTH];
+    int head;
+    int count;
+    bool closed;       /* No more frames will be pushed */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} frame_queue;
+
+typedef struct {
+    FILE *in;
+    FILE *out;
+    bool y4m;
+    int32_t width;
+    int32_t height;
+    size_t chroma_size;  /* Bytes of the chroma planes of a frame */
+    frame_queue decoded; /* From the reader to the filter */
+    frame_queue filtered; /* From the filter to the writer */
+} video_stream;
+
+/* Grayscale frame to filtered frame of the same size */
+typedef image_container *(*frame_filter)(image_container *frame);
+
+/* Filters every frame of stdin to stdout. The stream is Y4M when raw
+ * is NULL, else raw grayscale frames of raw->width x raw->height. The
+ * filter is called from the calling thread, the thread pool may be used.
+ * Returns the number of frames */
+int64_t video_filter(const raw_geometry *raw, frame_filter filter);
+
+#endif /* __VIDEO_H__ */
@@ -0,0 +1,777 @@
+/*
+ * File      : zlib_stream.c
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Coding Style : Linux Kernel - but with 4 space tabs
+ * https://www.kernel.org/doc/Documentation/CodingStyle
+ *
+ * ~ 80 Characters width
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib_stream.h"
+
+#define WINDOW_MASK (ZLIB_WINDOW_SIZE - 1)
+#define HASH_SIZE (1 << ZLIB_HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+/* Data kept after the compressed position so that matches can be found */
+#define MIN_LOOKAHEAD (MAX_MATCH + MIN_MATCH + 1)
+#define ADLER_BASE 65521
+
+enum {
+    STATE_HEADER,   /* zlib header */
+    STATE_BLOCK,    /* Block header */
+    STATE_STORED,   /* Inside a stored block */
+    STATE_HUFFMAN,  /* Inside a compressed block */
+    STATE_DONE      /* Trailer checked */
+};
+
+/* Base values and extra bits of the length and distance codes */
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+/* Order of the code length code lengths in a dynamic block header */
+static const uint8_t length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static void corrupted(const char *func)
+{
+    fprintf(stderr, "[%s] corrupted deflate stream\n", func);
+    exit(EXIT_FAILURE);
+}
+
+uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t size)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+
+    while (size) {
+        /* 5552 bytes is the most before the sums overflow */
+        size_t block = size < 5552 ? size : 5552;
+
+        size -= block;
+        while (block--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+/* The sums of the second part are shifted by the sums of the first one :
+ * a = a1 + a2 - 1 and b = b1 + b2 + size2 x (a1 - 1) */
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2)
+{
+    const uint32_t rem = size2 % ADLER_BASE;
+    uint32_t a1 = adler1 & 0xffff, b1 = adler1 >> 16;
+    uint32_t a2 = adler2 & 0xffff, b2 = adler2 >> 16;
+    uint32_t a, b;
+
+    a = (a1 + a2 + ADLER_BASE - 1) % ADLER_BASE;
+    b = ((uint64_t)rem * a1 % ADLER_BASE + b1 + b2 + ADLER_BASE - rem) %
+        ADLER_BASE;
+    return (b << 16) | a;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+    static uint32_t table[256];
+
+    if (!table[1]) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    while (size--) {
+        crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/*****************
+ * Decompression *
+ *****************/
+
+/* Makes sure there are at least 25 bits in the bit buffer, zeros are
+ * given after the end of the input */
+static void fill_bits(zlib_inflater *z)
+{
+    while (z->bit_count <= 24) {
+        uint32_t byte = 0;
+
+        if (z->in_pos == z->in_len && !z->in_end) {
+            z->in_len = z->read(z->ctx, z->in, ZLIB_IN_SIZE);
+            z->in_pos = 0;
+            z->in_end = z->in_len == 0;
+        }
+        if (z->in_pos < z->in_len) {
+            byte = z->in[z->in_pos++];
+        } else if (++z->padding > 8) {
+            corrupted(__func__);
+        }
+        z->bit_buf |= byte << z->bit_count;
+        z->bit_count += 8;
+    }
+}
+
+static uint32_t get_bits(zlib_inflater *z, int count)
+{
+    uint32_t bits;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (z->bit_count < count) {
+        fill_bits(z);
+    }
+    bits = z->bit_buf & ((1u << count) - 1);
+    z->bit_buf >>= count;
+    z->bit_count -= count;
+
+    return bits;
+}
+
+/* Builds the canonical code of the n symbol lengths */
+static void build_huffman(zlib_huffman *h, const uint8_t *lengths, int n)
+{
+    uint16_t offset[16];
+    uint32_t code = 0;
+    int len, sym;
+
+    memset(h->count, 0, sizeof (h->count));
+    memset(h->fast, 0, sizeof (h->fast));
+    for (sym = 0; sym < n; ++sym) {
+        h->count[lengths[sym]]++;
+    }
+    h->count[0] = 0;
+
+    offset[1] = 0;
+    for (len = 1; len < 15; ++len) {
+        offset[len + 1] = offset[len] + h->count[len];
+    }
+
+    /* Codes of a given length are consecutive, in symbol order */
+    for (len = 1; len < 16; ++len) {
+        for (sym = 0; sym < n; ++sym) {
+            if (lengths[sym] != len) {
+                continue;
+            }
+            h->symbol[offset[len]++] = sym;
+
+            if (len <= ZLIB_FAST_BITS) {
+                /* Codes are sent from their most significant bit */
+                uint32_t reversed = 0;
+
+                for (int i = 0; i < len; ++i) {
+                    reversed |= ((code >> i) & 1) << (len - 1 - i);
+                }
+                for (; reversed < (1 << ZLIB_FAST_BITS);
+                     reversed += 1 << len) {
+                    h->fast[reversed] = len << 9 | sym;
+                }
+            }
+            code++;
+        }
+        code <<= 1;
+    }
+}
+
+static int decode_symbol(zlib_inflater *z, const zlib_huffman *h)
+{
+    uint16_t entry;
+    int code = 0, first = 0, index = 0;
+
+    if (z->bit_count < 16) {
+        fill_bits(z);
+    }
+    entry = h->fast[z->bit_buf & ((1 << ZLIB_FAST_BITS) - 1)];
+    if (entry) {
+        z->bit_buf >>= entry >> 9;
+        z->bit_count -= entry >> 9;
+        return entry & 0x1ff;
+    }
+
+    /* Longer codes are decoded one bit at a time */
+    for (int len = 1; len < 16; ++len) {
+        code |= get_bits(z, 1);
+        if (code - first < h->count[len]) {
+            return h->symbol[index + code - first];
+        }
+        index += h->count[len];
+        first = (first + h->count[len]) << 1;
+        code <<= 1;
+    }
+    corrupted(__func__);
+    return -1;
+}
+
+static void read_dynamic_codes(zlib_inflater *z)
+{
+    uint8_t lengths[288 + 32];
+    zlib_huffman *lencode = &z->dist; /* Used as scratch before distances */
+    int nlen = get_bits(z, 5) + 257;
+    int ndist = get_bits(z, 5) + 1;
+    int ncode = get_bits(z, 4) + 4;
+    int index;
+
+    if (nlen > 286 || ndist > 30) {
+        corrupted(__func__);
+    }
+
+    memset(lengths, 0, 19);
+    for (index = 0; index < ncode; ++index) {
+        lengths[length_order[index]] = get_bits(z, 3);
+    }
+    build_huffman(lencode, lengths, 19);
+
+    index = 0;
+    while (index < nlen + ndist) {
+        int sym = decode_symbol(z, lencode);
+        int repeat, value = 0;
+
+        if (sym < 16) {
+            lengths[index++] = sym;
+            continue;
+        }
+        if (sym == 16) {
+            if (index == 0) {
+                corrupted(__func__);
+            }
+            value = lengths[index - 1];
+            repeat = 3 + get_bits(z, 2);
+        } else if (sym == 17) {
+            repeat = 3 + get_bits(z, 3);
+        } else {
+            repeat = 11 + get_bits(z, 7);
+        }
+        if (index + repeat > nlen + ndist) {
+            corrupted(__func__);
+        }
+        while (repeat--) {
+            lengths[index++] = value;
+        }
+    }
+
+    build_huffman(&z->lit, lengths, nlen);
+    build_huffman(&z->dist, lengths + nlen, ndist);
+}
+
+static void read_fixed_codes(zlib_inflater *z)
+{
+    uint8_t lengths[288];
+    int sym;
+
+    for (sym = 0; sym < 144; ++sym) {
+        lengths[sym] = 8;
+    }
+    for (; sym < 256; ++sym) {
+        lengths[sym] = 9;
+    }
+    for (; sym < 280; ++sym) {
+        lengths[sym] = 7;
+    }
+    for (; sym < 288; ++sym) {
+        lengths[sym] = 8;
+    }
+    build_huffman(&z->lit, lengths, 288);
+
+    for (sym = 0; sym < 30; ++sym) {
+        lengths[sym] = 5;
+    }
+    build_huffman(&z->dist, lengths, 30);
+}
+
+void zlib_inflate_init(zlib_inflater *z, zlib_read_function read, void *ctx)
+{
+    z->read = read;
+    z->ctx = ctx;
+    z->in_pos = 0;
+    z->in_len = 0;
+    z->in_end = false;
+    z->padding = 0;
+    z->bit_buf = 0;
+    z->bit_count = 0;
+    z->state = STATE_HEADER;
+    z->final = false;
+    z->stored_left = 0;
+    z->match_left = 0;
+    z->window_pos = 0;
+    z->adler = 1;
+}
+
+static void output_byte(zlib_inflater *z, uint8_t *out, size_t *n,
+                        uint8_t byte)
+{
+    out[(*n)++] = byte;
+    z->window[z->window_pos] = byte;
+    z->window_pos = (z->window_pos + 1) & WINDOW_MASK;
+}
+
+size_t zlib_inflate(zlib_inflater *z, uint8_t *out, size_t size)
+{
+    size_t n = 0;
+    int sym;
+
+    while (n < size) {
+        if (z->match_left) {
+            z->match_left--;
+            output_byte(z, out, &n,
+                        z->window[(z->window_pos - z->match_dist) &
+                                  WINDOW_MASK]);
+            continue;
+        }
+
+        switch (z->state) {
+        case STATE_HEADER: {
+            uint32_t cmf = get_bits(z, 8);
+            uint32_t flg = get_bits(z, 8);
+
+            /* Deflate, 32K window, no preset dictionary */
+            if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7 ||
+                ((cmf << 8) | flg) % 31 || (flg & 0x20)) {
+                corrupted(__func__);
+            }
+            z->state = STATE_BLOCK;
+            break;
+        }
+
+        case STATE_BLOCK:
+            if (z->final) {
+                uint32_t adler;
+
+                get_bits(z, z->bit_count & 7); /* Byte boundary */
+                adler = get_bits(z, 8) << 24;
+                adler |= get_bits(z, 8) << 16;
+                adler |= get_bits(z, 8) << 8;
+                adler |= get_bits(z, 8);
+                z->adler = adler32_update(z->adler, out, n);
+                if (adler != z->adler) {
+                    corrupted(__func__);
+                }
+                z->state = STATE_DONE;
+                return n;
+            }
+            z->final = get_bits(z, 1);
+            switch (get_bits(z, 2)) {
+            case 0:
+                get_bits(z, z->bit_count & 7);
+                z->stored_left = get_bits(z, 16);
+                if ((get_bits(z, 16) ^ 0xffff) != z->stored_left) {
+                    corrupted(__func__);
+                }
+                z->state = STATE_STORED;
+                break;
+            case 1:
+                read_fixed_codes(z);
+                z->state = STATE_HUFFMAN;
+                break;
+            case 2:
+                read_dynamic_codes(z);
+                z->state = STATE_HUFFMAN;
+                break;
+            default:
+                corrupted(__func__);
+            }
+            break;
+
+        case STATE_STORED:
+            if (z->stored_left == 0) {
+                z->state = STATE_BLOCK;
+                break;
+            }
+            z->stored_left--;
+            output_byte(z, out, &n, get_bits(z, 8));
+            break;
+
+        case STATE_HUFFMAN:
+            sym = decode_symbol(z, &z->lit);
+            if (sym < 256) {
+                output_byte(z, out, &n, sym);
+            } else if (sym == 256) {
+                z->state = STATE_BLOCK;
+            } else {
+                sym -= 257;
+                if (sym >= 29) {
+                    corrupted(__func__);
+                }
+                z->match_left = length_base[sym] +
+                                get_bits(z, length_extra[sym]);
+                sym = decode_symbol(z, &z->dist);
+                if (sym >= 30) {
+                    corrupted(__func__);
+                }
+                z->match_dist = dist_base[sym] +
+                                get_bits(z, dist_extra[sym]);
+            }
+            break;
+
+        case STATE_DONE:
+            return n;
+        }
+    }
+
+    z->adler = adler32_update(z->adler, out, n);
+    return n;
+}
+
+/***************
+ * Compression *
+ ***************/
+
+static void flush_output(zlib_deflater *z)
+{
+    if (z->out_len) {
+        z->write(z->ctx, z->out, z->out_len);
+        z->out_len = 0;
+    }
+}
+
+static void put_byte(zlib_deflater *z, uint8_t byte)
+{
+    z->out[z->out_len++] = byte;
+    if (z->out_len == ZLIB_OUT_SIZE) {
+        flush_output(z);
+    }
+}
+
+static void put_bits(zlib_deflater *z, uint32_t bits, int count)
+{
+    z->bit_buf |= bits << z->bit_count;
+    z->bit_count += count;
+    while (z->bit_count >= 8) {
+        put_byte(z, z->bit_buf & 0xff);
+        z->bit_buf >>= 8;
+        z->bit_count -= 8;
+    }
+}
+
+/* Huffman codes are sent from their most significant bit */
+static void put_code(zlib_deflater *z, uint32_t code, int count)
+{
+    uint32_t reversed = 0;
+
+    for (int i = 0; i < count; ++i) {
+        reversed |= ((code >> i) & 1) << (count - 1 - i);
+    }
+    put_bits(z, reversed, count);
+}
+
+static void align_output(zlib_deflater *z)
+{
+    if (z->bit_count) {
+        put_bits(z, 0, 8 - z->bit_count);
+    }
+}
+
+/* Literal/length symbol with the fixed Huffman code */
+static void put_fixed_symbol(zlib_deflater *z, int sym)
+{
+    if (!z->block_open) {
+        put_bits(z, 2, 3); /* Not final, fixed Huffman */
+        z->block_open = true;
+    }
+
+    if (sym < 144) {
+        put_code(z, 0x30 + sym, 8);
+    } else if (sym < 256) {
+        put_code(z, 0x190 + sym - 144, 9);
+    } else if (sym < 280) {
+        put_code(z, sym - 256, 7);
+    } else {
+        put_code(z, 0xc0 + sym - 280, 8);
+    }
+}
+
+static void close_block(zlib_deflater *z)
+{
+    if (z->block_open) {
+        put_fixed_symbol(z, 256);
+        z->block_open = false;
+    }
+}
+
+static void put_match(zlib_deflater *z, uint32_t length, uint32_t dist)
+{
+    int code;
+
+    for (code = 28; length_base[code] > length; --code)
+        ;
+    put_fixed_symbol(z, 257 + code);
+    put_bits(z, length - length_base[code], length_extra[code]);
+
+    for (code = 29; dist_base[code] > dist; --code)
+        ;
+    put_code(z, code, 5);
+    put_bits(z, dist - dist_base[code], dist_extra[code]);
+}
+
+static void put_stored(zlib_deflater *z, const uint8_t *data, uint32_t size)
+{
+    while (size) {
+        uint32_t block = size < 65535 ? size : 65535;
+
+        close_block(z);
+        put_bits(z, 0, 3); /* Not final, stored */
+        align_output(z);
+        put_bits(z, block, 16);
+        put_bits(z, block ^ 0xffff, 16);
+        for (uint32_t i = 0; i < block; ++i) {
+            put_byte(z, data[i]);
+        }
+        data += block;
+        size -= block;
+    }
+}
+
+static uint32_t hash3(const uint8_t *p)
+{
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+static void insert_hash(zlib_deflater *z, uint32_t pos)
+{
+    uint32_t h = hash3(z->window + pos);
+
+    z->prev[pos & WINDOW_MASK] = z->head[h];
+    z->head[h] = pos + 1;
+}
+
+/* Compresses the window up to limit */
+static void compress_window(zlib_deflater *z, uint32_t limit)
+{
+    /* Hash chain length of each level */
+    static const uint32_t chain_length[10] = {
+        0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+    const uint32_t max_chain = chain_length[z->level];
+
+    if (z->level == 0) {
+        put_stored(z, z->window + z->pos, limit - z->pos);
+        z->pos = limit;
+        return;
+    }
+
+    while (z->pos < limit) {
+        uint32_t avail = z->end - z->pos;
+        uint32_t best_len = 0, best_dist = 0;
+
+        if (avail >= MIN_MATCH) {
+            const uint8_t *cur = z->window + z->pos;
+            uint32_t max_len = avail < MAX_MATCH ? avail : MAX_MATCH;
+            uint32_t cand = z->head[hash3(cur)];
+            uint32_t chain = max_chain;
+
+            while (cand && chain--) {
+                uint32_t cand_pos = cand - 1;
+                const uint8_t *match = z->window + cand_pos;
+                uint32_t len = 0;
+
+                if (z->pos - cand_pos > ZLIB_WINDOW_SIZE) {
+                    break;
+                }
+                if (match[best_len] == cur[best_len]) {
+                    while (len < max_len && match[len] == cur[len]) {
+                        len++;
+                    }
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = z->pos - cand_pos;
+                        if (len == max_len) {
+                            break;
+                        }
+                    }
+                }
+                cand = z->prev[cand_pos & WINDOW_MASK];
+                if (cand && cand - 1 >= cand_pos) {
+                    break;
+                }
+            }
+            insert_hash(z, z->pos);
+        }
+
+        if (best_len >= MIN_MATCH) {
+            put_match(z, best_len, best_dist);
+            for (uint32_t i = 1; i < best_len; ++i) {
+                if (z->end - (z->pos + i) >= MIN_MATCH) {
+                    insert_hash(z, z->pos + i);
+                }
+            }
+            z->pos += best_len;
+        } else {
+            put_fixed_symbol(z, z->window[z->pos]);
+            z->pos++;
+        }
+    }
+}
+
+/* Moves the second half of the window to the first one */
+static void slide_window(zlib_deflater *z)
+{
+    uint32_t i;
+
+    memmove(z->window, z->window + ZLIB_WINDOW_SIZE,
+            z->end - ZLIB_WINDOW_SIZE);
+    z->pos -= ZLIB_WINDOW_SIZE;
+    z->end -= ZLIB_WINDOW_SIZE;
+
+    for (i = 0; i < HASH_SIZE; ++i) {
+        z->head[i] = z->head[i] > ZLIB_WINDOW_SIZE ?
+                     z->head[i] - ZLIB_WINDOW_SIZE : 0;
+    }
+    for (i = 0; i < ZLIB_WINDOW_SIZE; ++i) {
+        z->prev[i] = z->prev[i] > ZLIB_WINDOW_SIZE ?
+                     z->prev[i] - ZLIB_WINDOW_SIZE : 0;
+    }
+}
+
+void zlib_header(int level, uint8_t header[2])
+{
+    /* Deflate with a 32K window, the level is only informative */
+    header[0] = 0x78;
+    header[1] = level == 0 ? 0x01 : level < 6 ? 0x5e : level == 6 ? 0x9c :
+                                                                  0xda;
+}
+
+void zlib_deflate_init_raw(zlib_deflater *z, int level,
+                           zlib_write_function write, void *ctx)
+{
+    if (level < 0 || level > 9) {
+        level = ZLIB_DEFAULT_LEVEL;
+    }
+    z->level = level;
+    z->write = write;
+    z->ctx = ctx;
+
+    z->window = malloc(2 * ZLIB_WINDOW_SIZE);
+    z->head = calloc(HASH_SIZE, sizeof (uint32_t));
+    z->prev = calloc(ZLIB_WINDOW_SIZE, sizeof (uint32_t));
+    if (!z->window || !z->head || !z->prev) {
+        fprintf(stderr, "[%s] allocation error\n", __func__);
+        perror(__func__);
+        exit(EXIT_FAILURE);
+    }
+    z->pos = 0;
+    z->end = 0;
+
+    z->bit_buf = 0;
+    z->bit_count = 0;
+    z->block_open = false;
+    z->out_len = 0;
+    z->adler = 1;
+    z->raw = true;
+}
+
+void zlib_deflate_init(zlib_deflater *z, int level,
+                       zlib_write_function write, void *ctx)
+{
+    uint8_t header[2];
+
+    zlib_deflate_init_raw(z, level, write, ctx);
+    z->raw = false;
+
+    zlib_header(z->level, header);
+    put_byte(z, header[0]);
+    put_byte(z, header[1]);
+}
+
+void zlib_deflate_set_dictionary(zlib_deflater *z, const uint8_t *dict,
+                                 size_t size)
+{
+    uint32_t i;
+
+    /* Only the last window can be referenced */
+    if (size > ZLIB_WINDOW_SIZE) {
+        dict += size - ZLIB_WINDOW_SIZE;
+        size = ZLIB_WINDOW_SIZE;
+    }
+    memcpy(z->window, dict, size);
+    z->pos = size;
+    z->end = size;
+    for (i = 0; i + MIN_MATCH <= size; ++i) {
+        insert_hash(z, i);
+    }
+}
+
+void zlib_deflate_write(zlib_deflater *z, const uint8_t *data, size_t size)
+{
+    z->adler = adler32_update(z->adler, data, size);
+
+    while (size) {
+        uint32_t room = 2 * ZLIB_WINDOW_SIZE - z->end;
+        uint32_t count = size < room ? size : room;
+
+        memcpy(z->window + z->end, data, count);
+        z->end += count;
+        data += count;
+        size -= count;
+
+        if (z->end == 2 * ZLIB_WINDOW_SIZE) {
+            compress_window(z, z->end - MIN_LOOKAHEAD);
+            slide_window(z);
+        }
+    }
+}
+
+void zlib_deflate_flush(zlib_deflater *z)
+{
+    compress_window(z, z->end);
+    close_block(z);
+    put_bits(z, 0, 3); /* Empty stored block */
+    align_output(z);
+    put_bits(z, 0xffff0000, 32);
+    flush_output(z);
+}
+
+void zlib_deflate_finish(zlib_deflater *z)
+{
+    compress_window(z, z->end);
+    close_block(z);
+
+    /* Empty final block : final, fixed Huffman and end of block code */
+    put_bits(z, 3, 3);
+    put_code(z, 0, 7);
+    align_output(z);
+
+    if (!z->raw) {
+        put_byte(z, z->adler >> 24);
+        put_byte(z, z->adler >> 16);
+        put_byte(z, z->adler >> 8);
+        put_byte(z, z->adler);
+    }
+    flush_output(z);
+
+    zlib_deflate_release(z);
+}
+
+void zlib_deflate_release(zlib_deflater *z)
+{
+    free(z->window);
+    free(z->head);
+    free(z->prev);
+    z->window = NULL;
+}
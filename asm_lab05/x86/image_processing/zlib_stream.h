@@ -0,0 +1,120 @@
+/*
+ * File      : zlib_stream.h
+ * Author    : Rafael Dousse
+ * Institute : REDS - HES-SO HEIG-VD
+ *
+ * Incremental zlib (RFC 1950 / RFC 1951) decompression and compression.
+ * Both sides only keep the 32 KiB deflate window, so the memory used does
+ * not depend on the size of the data.
+ */
+
+#ifndef __ZLIB_STREAM_H__
+#define __ZLIB_STREAM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZLIB_WINDOW_SIZE 32768
+#define ZLIB_FAST_BITS 9   /* Codes up to 9 bits are decoded by a lookup */
+#define ZLIB_IN_SIZE 4096
+#define ZLIB_OUT_SIZE 16384
+#define ZLIB_HASH_BITS 15
+
+#define ZLIB_DEFAULT_LEVEL 6
+
+/* Returns the number of bytes read into buf, 0 at the end of the data */
+typedef size_t (*zlib_read_function)(void *ctx, uint8_t *buf, size_t size);
+/* Receives size bytes of compressed data */
+typedef void (*zlib_write_function)(void *ctx, const uint8_t *buf,
+                                    size_t size);
+
+/* Canonical Huffman code */
+typedef struct {
+    uint16_t count[16];       /* Number of codes of each length */
+    uint16_t symbol[288];     /* Symbols ordered by code */
+    uint16_t fast[1 << ZLIB_FAST_BITS]; /* length << 9 | symbol, 0 : slow */
+} zlib_huffman;
+
+typedef struct {
+    zlib_read_function read;
+    void *ctx;
+    uint8_t in[ZLIB_IN_SIZE];
+    size_t in_pos;
+    size_t in_len;
+    bool in_end;
+    uint32_t padding;         /* Zero bytes given after the end of input */
+
+    uint32_t bit_buf;
+    int bit_count;
+
+    int state;
+    bool final;               /* Current block is the last one */
+    uint32_t stored_left;     /* Bytes left in a stored block */
+    uint32_t match_left;      /* Bytes left to copy from a match */
+    uint32_t match_dist;
+
+    zlib_huffman lit;         /* Literal/length code */
+    zlib_huffman dist;        /* Distance code */
+
+    uint8_t window[ZLIB_WINDOW_SIZE];
+    uint32_t window_pos;
+    uint32_t adler;
+} zlib_inflater;
+
+typedef struct {
+    int level;                /* 0 : stored, 1 (fast) to 9 (small) */
+    zlib_write_function write;
+    void *ctx;
+
+    uint8_t *window;          /* 2 x ZLIB_WINDOW_SIZE */
+    uint32_t *head;           /* Last position + 1 of each hash, 0 : none */
+    uint32_t *prev;           /* Previous position + 1 with the same hash */
+    uint32_t pos;             /* Next byte to compress */
+    uint32_t end;             /* End of the data in the window */
+
+    uint32_t bit_buf;
+    int bit_count;
+    bool block_open;          /* A fixed Huffman block has been started */
+    uint8_t out[ZLIB_OUT_SIZE];
+    size_t out_len;
+
+    uint32_t adler;
+    bool raw;                 /* No zlib header and Adler-32 trailer */
+} zlib_deflater;
+
+uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t size);
+/* Adler-32 of the data of adler1 followed by size2 bytes of adler2 */
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2);
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+/* Decompression, the zlib header is checked by the first read */
+void zlib_inflate_init(zlib_inflater *z, zlib_read_function read, void *ctx);
+/* Decompresses up to size bytes into out and returns the number of bytes
+ * written, which is less than size only at the end of the stream.
+ * Exits on corrupted data */
+size_t zlib_inflate(zlib_inflater *z, uint8_t *out, size_t size);
+
+/* Compression, see zlib_deflater for the level */
+void zlib_deflate_init(zlib_deflater *z, int level,
+                       zlib_write_function write, void *ctx);
+/* Same for a raw deflate stream (RFC 1951). Streams ended by a sync
+ * flush can be concatenated, the last one by zlib_deflate_finish() */
+void zlib_deflate_init_raw(zlib_deflater *z, int level,
+                           zlib_write_function write, void *ctx);
+/* The 2 bytes of the zlib header of a stream of this level */
+void zlib_header(int level, uint8_t header[2]);
+/* Data before the stream that matches may refer to, not compressed.
+ * Must be called before the first write */
+void zlib_deflate_set_dictionary(zlib_deflater *z, const uint8_t *dict,
+                                 size_t size);
+void zlib_deflate_write(zlib_deflater *z, const uint8_t *data, size_t size);
+/* Compresses all pending data and ends on a byte boundary with an empty
+ * stored block (sync flush) */
+void zlib_deflate_flush(zlib_deflater *z);
+/* Ends the stream and releases the window */
+void zlib_deflate_finish(zlib_deflater *z);
+/* Releases the window without ending the stream */
+void zlib_deflate_release(zlib_deflater *z);
+
+#endif /* __ZLIB_STREAM_H__ */